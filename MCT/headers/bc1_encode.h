@@ -0,0 +1,177 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MC_BLOCK_SSE 1
+#include <emmintrin.h>
+#endif
+
+/* Block encoder shared by the compressed mesh colors and the bcn textures.
+   A block is 16 colors, two rgb565 endpoints and a 2 bit index per color picking one of
+   four colors evenly spaced between them, k = 0 is e0 and k = 3 is e1. Endpoints start on
+   the principal axis of the colors and are refit once by least squares to the indices. */
+
+#define MC_BLOCK_SAMPLES 16
+
+struct mc_block {
+	//e0 in the low 16 bits, e1 in the high, rgb565
+	uint32_t endpoints;
+	//2 bits per sample, sample 0 in the low bits
+	uint32_t indices;
+};
+
+namespace {
+	uint16_t to565(const glm::vec3& c)
+	{
+		glm::vec3 q = glm::clamp(c, glm::vec3(0.0f), glm::vec3(255.0f));
+		unsigned int r = (unsigned int)(q.x * 31.0f / 255.0f + 0.5f);
+		unsigned int g = (unsigned int)(q.y * 63.0f / 255.0f + 0.5f);
+		unsigned int b = (unsigned int)(q.z * 31.0f / 255.0f + 0.5f);
+		return uint16_t((r << 11) | (g << 5) | b);
+	}
+
+	glm::vec3 from565(uint16_t c)
+	{
+		unsigned int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+		return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+
+	//samples of a block in soa form, unused lanes repeat the first sample
+	struct block_samples {
+		float r[MC_BLOCK_SAMPLES], g[MC_BLOCK_SAMPLES], b[MC_BLOCK_SAMPLES];
+		unsigned int n;
+	};
+
+	//nearest of the four colors along e0 -> e1 for every sample, returns the indices and the squared error
+	uint32_t block_indices(const block_samples& s, const glm::vec3& e0, const glm::vec3& e1, float& error)
+	{
+		glm::vec3 d = e1 - e0;
+		float len2 = glm::dot(d, d);
+		float scale = len2 > 0.0f ? 3.0f / len2 : 0.0f;
+		uint32_t idx = 0;
+		error = 0.0f;
+#ifdef MC_BLOCK_SSE
+		__m128 dr = _mm_set1_ps(d.x * scale), dg = _mm_set1_ps(d.y * scale), db = _mm_set1_ps(d.z * scale);
+		__m128 er = _mm_set1_ps(e0.x), eg = _mm_set1_ps(e0.y), eb = _mm_set1_ps(e0.z);
+		__m128 third_r = _mm_set1_ps(d.x / 3.0f), third_g = _mm_set1_ps(d.y / 3.0f), third_b = _mm_set1_ps(d.z / 3.0f);
+		__m128 err = _mm_setzero_ps();
+		for (int q = 0; q < MC_BLOCK_SAMPLES; q += 4)
+		{
+			__m128 r = _mm_sub_ps(_mm_loadu_ps(s.r + q), er);
+			__m128 g = _mm_sub_ps(_mm_loadu_ps(s.g + q), eg);
+			__m128 b = _mm_sub_ps(_mm_loadu_ps(s.b + q), eb);
+			__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, dr), _mm_mul_ps(g, dg)), _mm_mul_ps(b, db));
+			t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(3.0f));
+			__m128i k = _mm_cvtps_epi32(t);
+			__m128 kf = _mm_cvtepi32_ps(k);
+			//distance to the picked color
+			r = _mm_sub_ps(r, _mm_mul_ps(kf, third_r));
+			g = _mm_sub_ps(g, _mm_mul_ps(kf, third_g));
+			b = _mm_sub_ps(b, _mm_mul_ps(kf, third_b));
+			err = _mm_add_ps(err, _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b)));
+			int lane[4];
+			_mm_storeu_si128((__m128i*)lane, k);
+			for (int l = 0; l < 4; l++) {
+				idx |= uint32_t(lane[l]) << (2 * (q + l));
+			}
+		}
+		float e4[4];
+		_mm_storeu_ps(e4, err);
+		error = e4[0] + e4[1] + e4[2] + e4[3];
+#else
+		for (int m = 0; m < MC_BLOCK_SAMPLES; m++)
+		{
+			glm::vec3 c = glm::vec3(s.r[m], s.g[m], s.b[m]) - e0;
+			float t = std::min(3.0f, std::max(0.0f, glm::dot(c, d) * scale));
+			int k = int(t + 0.5f);
+			glm::vec3 r = c - d * (float(k) / 3.0f);
+			error += glm::dot(r, r);
+			idx |= uint32_t(k) << (2 * m);
+		}
+#endif
+		return idx;
+	}
+
+	//endpoints along the principal axis, then one least squares refit of them to the picked indices
+	mc_block encode_block(const block_samples& s)
+	{
+		unsigned int n = s.n;
+		glm::vec3 mean(0.0f);
+		for (unsigned int m = 0; m < n; m++) {
+			mean += glm::vec3(s.r[m], s.g[m], s.b[m]);
+		}
+		mean /= float(n);
+		float cov[6] = { 0, 0, 0, 0, 0, 0 };
+		for (unsigned int m = 0; m < n; m++)
+		{
+			glm::vec3 c = glm::vec3(s.r[m], s.g[m], s.b[m]) - mean;
+			cov[0] += c.x * c.x; cov[1] += c.x * c.y; cov[2] += c.x * c.z;
+			cov[3] += c.y * c.y; cov[4] += c.y * c.z; cov[5] += c.z * c.z;
+		}
+		//start from the covariance column of the widest channel, never orthogonal to the principal axis
+		glm::vec3 axis;
+		if (cov[0] >= cov[3] && cov[0] >= cov[5]) axis = glm::vec3(cov[0], cov[1], cov[2]);
+		else if (cov[3] >= cov[5]) axis = glm::vec3(cov[1], cov[3], cov[4]);
+		else axis = glm::vec3(cov[2], cov[4], cov[5]);
+		for (int it = 0; it < 8; it++)
+		{
+			axis = glm::vec3(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+				cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+				cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+			float l = glm::length(axis);
+			if (l < 1e-12f) {
+				axis = glm::vec3(0.0f);
+				break;
+			}
+			axis /= l;
+		}
+		float t0 = 0.0f, t1 = 0.0f;
+		for (unsigned int m = 0; m < n; m++)
+		{
+			float t = glm::dot(glm::vec3(s.r[m], s.g[m], s.b[m]) - mean, axis);
+			t0 = std::min(t0, t);
+			t1 = std::max(t1, t);
+		}
+
+		mc_block best;
+		uint16_t q0 = to565(mean + axis * t0), q1 = to565(mean + axis * t1);
+		float best_error;
+		best.endpoints = uint32_t(q0) | (uint32_t(q1) << 16);
+		best.indices = block_indices(s, from565(q0), from565(q1), best_error);
+
+		//least squares endpoints for the indices just picked, weights (3 - k) / 3 and k / 3
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		glm::vec3 ax(0.0f), bx(0.0f);
+		for (unsigned int m = 0; m < n; m++)
+		{
+			float w = float((best.indices >> (2 * m)) & 3) / 3.0f;
+			glm::vec3 c(s.r[m], s.g[m], s.b[m]);
+			aa += (1.0f - w) * (1.0f - w);
+			ab += (1.0f - w) * w;
+			bb += w * w;
+			ax += c * (1.0f - w);
+			bx += c * w;
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) > 1e-6f)
+		{
+			uint16_t r0 = to565((ax * bb - bx * ab) / det), r1 = to565((bx * aa - ax * ab) / det);
+			float error;
+			uint32_t idx = block_indices(s, from565(r0), from565(r1), error);
+			if (error < best_error) {
+				best.endpoints = uint32_t(r0) | (uint32_t(r1) << 16);
+				best.indices = idx;
+			}
+		}
+		//padding lanes index 0
+		if (n < MC_BLOCK_SAMPLES) {
+			best.indices &= (uint32_t(1) << (2 * n)) - 1;
+		}
+		return best;
+	}
+};
+
@@ -0,0 +1,646 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cfloat>
+#include "model.h"
+#include "parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+/* Bounding volume hierarchy over the triangles of a Model.
+   Built top down with a binned surface area heuristic, leaves hold up to four triangles
+   packed lane by lane in a tri4 block so a ray is tested against all of them at once.
+   Node children are always allocated after their parent, which lets refit run as a
+   single backwards sweep. */
+
+#define BVH_LEAF_SIZE 4
+#define BVH_BINS 16
+#define BVH_NO_FACE 0xFFFFFFFFu
+//below this depth nodes are split at the median, which keeps any tree under BVH_SAH_DEPTH + 32 levels
+#define BVH_SAH_DEPTH 64
+//traversal stack, one entry per level plus the sibling pushed with it
+#define BVH_STACK_SIZE 128
+
+struct bvh_node {
+	glm::vec3 bmin;
+	unsigned int first; //left child (right is first + 1) or tri4 block for leaves
+	glm::vec3 bmax;
+	unsigned int count; //0 for inner nodes, triangle count for leaves
+};
+
+//four triangles in structure of arrays form: v0, edge v0->v1, edge v0->v2
+struct alignas(16) tri4 {
+	float v0[3][4];
+	float e1[3][4];
+	float e2[3][4];
+};
+
+struct ray {
+	glm::vec3 o;
+	glm::vec3 d;
+	float tmin = 0.0f;
+	float tmax = FLT_MAX;
+};
+
+//face hit at o + t*d, point = (1-u-v)*v0 + u*v1 + v*v2
+struct ray_hit {
+	float t = FLT_MAX;
+	unsigned int face = BVH_NO_FACE;
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+//closest surface point, point = (1-u-v)*v0 + u*v1 + v*v2 at squared distance d2
+struct point_hit {
+	float d2 = FLT_MAX;
+	unsigned int face = BVH_NO_FACE;
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+//closest point to p on triangle abc as barycentric weights of b and c
+glm::vec2 closest_on_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) return glm::vec2(0.0f, 0.0f);
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) return glm::vec2(1.0f, 0.0f);
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return glm::vec2(d1 / (d1 - d3), 0.0f);
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) return glm::vec2(0.0f, 1.0f);
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return glm::vec2(0.0f, d2 / (d2 - d6));
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		return glm::vec2(1.0f - w, w);
+	}
+	float denom = va + vb + vc;
+	if (denom == 0.0f) return glm::vec2(0.0f, 0.0f);
+	return glm::vec2(vb / denom, vc / denom);
+}
+
+class bvh {
+public:
+	bvh() {}
+	bvh(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds) { build(verts, inds); }
+	bvh(const Model& m) { build(m.vertices, m.indices); }
+
+	void build(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds)
+	{
+		vertices = &verts;
+		indices = &inds;
+		unsigned int nf = (unsigned int)(inds.size() / 3);
+		nodes.clear();
+		blocks.clear();
+		block_faces.clear();
+		if (nf == 0) {
+			return;
+		}
+
+		faces.resize(nf);
+		cmin.resize(nf);
+		cmax.resize(nf);
+		centroid.resize(nf);
+		parallel_for(0, nf, [&](size_t f) {
+			glm::vec3 a, b, c;
+			corners((unsigned int)f, a, b, c);
+			faces[f] = (unsigned int)f;
+			cmin[f] = glm::min(a, glm::min(b, c));
+			cmax[f] = glm::max(a, glm::max(b, c));
+			centroid[f] = (cmin[f] + cmax[f]) * 0.5f;
+		});
+
+		nodes.resize(2 * size_t(nf));
+		node_count.store(1);
+		build_node(0, 0, nf, 0);
+		nodes.resize(node_count.load());
+
+		//one tri4 block per leaf
+		unsigned int leaves = 0;
+		for (auto& n : nodes) {
+			if (n.count > 0) {
+				unsigned int first = n.first;
+				n.first = leaves++;
+				block_faces.resize(size_t(leaves) * 4, BVH_NO_FACE);
+				for (unsigned int i = 0; i < n.count; i++) {
+					block_faces[size_t(n.first) * 4 + i] = faces[first + i];
+				}
+			}
+		}
+		blocks.resize(leaves);
+		refit();
+
+		//only needed while building
+		std::vector<glm::vec3>().swap(cmin);
+		std::vector<glm::vec3>().swap(cmax);
+		std::vector<glm::vec3>().swap(centroid);
+		std::vector<unsigned int>().swap(faces);
+	}
+
+	//updates triangle data and bounds after vertex positions changed, topology must be the same
+	void refit()
+	{
+		parallel_for(0, blocks.size(), [&](size_t b) { pack_block((unsigned int)b); });
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			bvh_node& n = nodes[i];
+			if (n.count > 0)
+			{
+				n.bmin = glm::vec3(FLT_MAX);
+				n.bmax = glm::vec3(-FLT_MAX);
+				for (unsigned int k = 0; k < n.count; k++)
+				{
+					glm::vec3 a, b, c;
+					corners(block_faces[size_t(n.first) * 4 + k], a, b, c);
+					n.bmin = glm::min(n.bmin, glm::min(a, glm::min(b, c)));
+					n.bmax = glm::max(n.bmax, glm::max(a, glm::max(b, c)));
+				}
+			}
+			else
+			{
+				n.bmin = glm::min(nodes[n.first].bmin, nodes[n.first + 1].bmin);
+				n.bmax = glm::max(nodes[n.first].bmax, nodes[n.first + 1].bmax);
+			}
+		}
+	}
+
+	//closest hit along the ray
+	bool intersect(const ray& r, ray_hit& hit) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		glm::vec3 inv = 1.0f / r.d;
+		float tmax = std::min(r.tmax, hit.t);
+		unsigned int stack[BVH_STACK_SIZE];
+		unsigned int sp = 0;
+		stack[sp++] = 0;
+		bool found = false;
+		while (sp > 0)
+		{
+			const bvh_node& n = nodes[stack[--sp]];
+			float tn;
+			if (!slab(n, r.o, inv, r.tmin, tmax, tn)) {
+				continue;
+			}
+			if (n.count > 0) {
+				if (intersect_block(n.first, r, tmax, hit)) {
+					tmax = hit.t;
+					found = true;
+				}
+				continue;
+			}
+			//visit the nearer child first
+			float tl, tr;
+			bool hl = slab(nodes[n.first], r.o, inv, r.tmin, tmax, tl);
+			bool hr = slab(nodes[n.first + 1], r.o, inv, r.tmin, tmax, tr);
+			if (hl && hr) {
+				stack[sp++] = tl < tr ? n.first + 1 : n.first;
+				stack[sp++] = tl < tr ? n.first : n.first + 1;
+			}
+			else if (hl) {
+				stack[sp++] = n.first;
+			}
+			else if (hr) {
+				stack[sp++] = n.first + 1;
+			}
+		}
+		return found;
+	}
+
+	//any hit along the ray, for shadow and occlusion rays
+	bool occluded(const ray& r) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		glm::vec3 inv = 1.0f / r.d;
+		unsigned int stack[BVH_STACK_SIZE];
+		unsigned int sp = 0;
+		stack[sp++] = 0;
+		while (sp > 0)
+		{
+			const bvh_node& n = nodes[stack[--sp]];
+			float tn;
+			if (!slab(n, r.o, inv, r.tmin, r.tmax, tn)) {
+				continue;
+			}
+			if (n.count > 0) {
+				ray_hit hit;
+				if (intersect_block(n.first, r, r.tmax, hit)) {
+					return true;
+				}
+				continue;
+			}
+			stack[sp++] = n.first + 1;
+			stack[sp++] = n.first;
+		}
+		return false;
+	}
+
+	//occlusion of a packet of four rays traversed together, returns the mask of blocked rays
+	int occluded4(const ray r[4], int active = 0xF) const
+	{
+		if (nodes.empty() || active == 0) {
+			return 0;
+		}
+#ifdef BVH_SSE
+		float ox[4], oy[4], oz[4], ix[4], iy[4], iz[4], tmin[4], tmax[4];
+		for (int k = 0; k < 4; k++)
+		{
+			ox[k] = r[k].o.x; oy[k] = r[k].o.y; oz[k] = r[k].o.z;
+			ix[k] = 1.0f / r[k].d.x; iy[k] = 1.0f / r[k].d.y; iz[k] = 1.0f / r[k].d.z;
+			tmin[k] = r[k].tmin; tmax[k] = r[k].tmax;
+		}
+		__m128 Ox = _mm_loadu_ps(ox), Oy = _mm_loadu_ps(oy), Oz = _mm_loadu_ps(oz);
+		__m128 Ix = _mm_loadu_ps(ix), Iy = _mm_loadu_ps(iy), Iz = _mm_loadu_ps(iz);
+		__m128 Tmin = _mm_loadu_ps(tmin), Tmax = _mm_loadu_ps(tmax);
+
+		int blocked = 0;
+		unsigned int stack[BVH_STACK_SIZE];
+		unsigned int sp = 0;
+		stack[sp++] = 0;
+		while (sp > 0)
+		{
+			const bvh_node& n = nodes[stack[--sp]];
+			//slab test of the box against the four rays
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmin.x), Ox), Ix);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmax.x), Ox), Ix);
+			__m128 lo = _mm_max_ps(Tmin, _mm_min_ps(t0, t1));
+			__m128 hi = _mm_min_ps(Tmax, _mm_max_ps(t0, t1));
+			t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmin.y), Oy), Iy);
+			t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmax.y), Oy), Iy);
+			lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+			hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+			t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmin.z), Oz), Iz);
+			t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.bmax.z), Oz), Iz);
+			lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+			hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+			int lanes = _mm_movemask_ps(_mm_cmple_ps(lo, hi)) & active & ~blocked;
+			if (lanes == 0) {
+				continue;
+			}
+			if (n.count > 0)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					ray_hit hit;
+					if ((lanes & (1 << k)) && intersect_block(n.first, r[k], r[k].tmax, hit)) {
+						blocked |= 1 << k;
+					}
+				}
+				if ((blocked & active) == active) {
+					break;
+				}
+				continue;
+			}
+			stack[sp++] = n.first + 1;
+			stack[sp++] = n.first;
+		}
+		return blocked;
+#else
+		int blocked = 0;
+		for (int k = 0; k < 4; k++) {
+			if ((active & (1 << k)) && occluded(r[k])) {
+				blocked |= 1 << k;
+			}
+		}
+		return blocked;
+#endif
+	}
+
+	//closest point on the surface within sqrt(hit.d2) of p, hit.d2 can be preset as a search radius
+	bool closest_point(const glm::vec3& p, point_hit& hit) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		unsigned int stack[BVH_STACK_SIZE];
+		unsigned int sp = 0;
+		stack[sp++] = 0;
+		bool found = false;
+		while (sp > 0)
+		{
+			const bvh_node& n = nodes[stack[--sp]];
+			if (box_distance2(n, p) >= hit.d2) {
+				continue;
+			}
+			if (n.count > 0) {
+				for (unsigned int k = 0; k < n.count; k++)
+				{
+					unsigned int f = block_faces[size_t(n.first) * 4 + k];
+					glm::vec3 a, b, c;
+					corners(f, a, b, c);
+					glm::vec2 w = closest_on_triangle(p, a, b, c);
+					glm::vec3 q = a + (b - a) * w.x + (c - a) * w.y - p;
+					float d2 = glm::dot(q, q);
+					if (d2 < hit.d2) {
+						hit.d2 = d2;
+						hit.face = f;
+						hit.u = w.x;
+						hit.v = w.y;
+						found = true;
+					}
+				}
+				continue;
+			}
+			//visit the nearer child first
+			float dl = box_distance2(nodes[n.first], p);
+			float dr = box_distance2(nodes[n.first + 1], p);
+			stack[sp++] = dl < dr ? n.first + 1 : n.first;
+			stack[sp++] = dl < dr ? n.first : n.first + 1;
+		}
+		return found;
+	}
+
+	//faces whose bounds touch the sphere
+	void query_sphere(const glm::vec3& c, float radius, std::vector<unsigned int>& out) const
+	{
+		out.clear();
+		if (nodes.empty()) {
+			return;
+		}
+		float r2 = radius * radius;
+		unsigned int stack[BVH_STACK_SIZE];
+		unsigned int sp = 0;
+		stack[sp++] = 0;
+		while (sp > 0)
+		{
+			const bvh_node& n = nodes[stack[--sp]];
+			glm::vec3 q = glm::clamp(c, n.bmin, n.bmax) - c;
+			if (glm::dot(q, q) > r2) {
+				continue;
+			}
+			if (n.count > 0) {
+				for (unsigned int k = 0; k < n.count; k++) {
+					out.push_back(block_faces[size_t(n.first) * 4 + k]);
+				}
+			}
+			else {
+				stack[sp++] = n.first;
+				stack[sp++] = n.first + 1;
+			}
+		}
+	}
+
+	unsigned int face_count() const { return indices ? (unsigned int)(indices->size() / 3) : 0; }
+
+	void corners(unsigned int f, glm::vec3& a, glm::vec3& b, glm::vec3& c) const
+	{
+		a = (*vertices)[(*indices)[3 * f + 0]].pos;
+		b = (*vertices)[(*indices)[3 * f + 1]].pos;
+		c = (*vertices)[(*indices)[3 * f + 2]].pos;
+	}
+
+	std::vector<bvh_node> nodes;
+	std::vector<tri4> blocks;
+	std::vector<unsigned int> block_faces;
+
+private:
+	struct bin {
+		glm::vec3 bmin = glm::vec3(FLT_MAX);
+		glm::vec3 bmax = glm::vec3(-FLT_MAX);
+		unsigned int count = 0;
+	};
+
+	static float area(const glm::vec3& bmin, const glm::vec3& bmax)
+	{
+		glm::vec3 e = glm::max(bmax - bmin, glm::vec3(0.0f));
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	static float box_distance2(const bvh_node& n, const glm::vec3& p)
+	{
+		glm::vec3 q = glm::clamp(p, n.bmin, n.bmax) - p;
+		return glm::dot(q, q);
+	}
+
+	static bool slab(const bvh_node& n, const glm::vec3& o, const glm::vec3& inv, float tmin, float tmax, float& tnear)
+	{
+		glm::vec3 t0 = (n.bmin - o) * inv;
+		glm::vec3 t1 = (n.bmax - o) * inv;
+		glm::vec3 lo = glm::min(t0, t1);
+		glm::vec3 hi = glm::max(t0, t1);
+		tnear = std::max(tmin, std::max(lo.x, std::max(lo.y, lo.z)));
+		float tfar = std::min(tmax, std::min(hi.x, std::min(hi.y, hi.z)));
+		return tnear <= tfar;
+	}
+
+	void build_node(unsigned int id, unsigned int first, unsigned int count, unsigned int depth)
+	{
+		bvh_node& node = nodes[id];
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (unsigned int i = first; i < first + count; i++) {
+			lo = glm::min(lo, centroid[faces[i]]);
+			hi = glm::max(hi, centroid[faces[i]]);
+		}
+		if (count <= BVH_LEAF_SIZE) {
+			node.first = first;
+			node.count = count;
+			return;
+		}
+
+		//binned sah over the centroid bounds
+		int best_axis = -1;
+		int best_split = 0;
+		float best_cost = FLT_MAX;
+		for (int axis = 0; axis < 3 && depth < BVH_SAH_DEPTH; axis++)
+		{
+			float extent = hi[axis] - lo[axis];
+			if (extent <= 0.0f) {
+				continue;
+			}
+			float scale = BVH_BINS / extent;
+			bin bins[BVH_BINS];
+			for (unsigned int i = first; i < first + count; i++)
+			{
+				unsigned int f = faces[i];
+				int b = std::min(BVH_BINS - 1, int((centroid[f][axis] - lo[axis]) * scale));
+				bins[b].count++;
+				bins[b].bmin = glm::min(bins[b].bmin, cmin[f]);
+				bins[b].bmax = glm::max(bins[b].bmax, cmax[f]);
+			}
+			float right_area[BVH_BINS];
+			unsigned int right_count[BVH_BINS];
+			bin acc;
+			for (int b = BVH_BINS - 1; b > 0; b--)
+			{
+				acc.count += bins[b].count;
+				acc.bmin = glm::min(acc.bmin, bins[b].bmin);
+				acc.bmax = glm::max(acc.bmax, bins[b].bmax);
+				right_area[b] = area(acc.bmin, acc.bmax);
+				right_count[b] = acc.count;
+			}
+			acc = bin();
+			for (int b = 0; b < BVH_BINS - 1; b++)
+			{
+				acc.count += bins[b].count;
+				acc.bmin = glm::min(acc.bmin, bins[b].bmin);
+				acc.bmax = glm::max(acc.bmax, bins[b].bmax);
+				if (acc.count == 0 || right_count[b + 1] == 0) {
+					continue;
+				}
+				float cost = area(acc.bmin, acc.bmax) * acc.count + right_area[b + 1] * right_count[b + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b;
+				}
+			}
+		}
+
+		unsigned int mid;
+		if (depth >= BVH_SAH_DEPTH)
+		{
+			//degenerate sah splits got this deep, halve the rest along the widest axis
+			glm::vec3 extent = hi - lo;
+			int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+			mid = first + count / 2;
+			std::nth_element(faces.begin() + first, faces.begin() + mid, faces.begin() + first + count, [&](unsigned int a, unsigned int b) {
+				return centroid[a][axis] < centroid[b][axis];
+			});
+		}
+		else if (best_axis >= 0)
+		{
+			float scale = BVH_BINS / (hi[best_axis] - lo[best_axis]);
+			auto it = std::partition(faces.begin() + first, faces.begin() + first + count, [&](unsigned int f) {
+				return std::min(BVH_BINS - 1, int((centroid[f][best_axis] - lo[best_axis]) * scale)) <= best_split;
+			});
+			mid = (unsigned int)(it - faces.begin());
+		}
+		else
+		{
+			//every centroid in the same spot, any split is as good
+			mid = first + count / 2;
+		}
+
+		unsigned int left = node_count.fetch_add(2);
+		node.first = left;
+		node.count = 0;
+
+		//large subtrees near the root are built on their own thread
+		if (count > 65536 && depth < 4) {
+			std::thread t([=]() { build_node(left, first, mid - first, depth + 1); });
+			build_node(left + 1, mid, first + count - mid, depth + 1);
+			t.join();
+		}
+		else {
+			build_node(left, first, mid - first, depth + 1);
+			build_node(left + 1, mid, first + count - mid, depth + 1);
+		}
+	}
+
+	void pack_block(unsigned int b)
+	{
+		tri4& t = blocks[b];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			unsigned int f = block_faces[size_t(b) * 4 + lane];
+			glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+			if (f != BVH_NO_FACE) {
+				glm::vec3 v1, v2;
+				corners(f, v0, v1, v2);
+				e1 = v1 - v0;
+				e2 = v2 - v0;
+			}
+			for (int k = 0; k < 3; k++) {
+				t.v0[k][lane] = v0[k];
+				t.e1[k][lane] = e1[k];
+				t.e2[k][lane] = e2[k];
+			}
+		}
+	}
+
+	//moller trumbore against the four lanes of a block, empty lanes are degenerate and never hit
+	bool intersect_block(unsigned int b, const ray& r, float tmax, ray_hit& hit) const
+	{
+		const tri4& t = blocks[b];
+		float tt[4], uu[4], vv[4];
+		int mask = 0;
+#ifdef BVH_SSE
+		__m128 dx = _mm_set1_ps(r.d.x), dy = _mm_set1_ps(r.d.y), dz = _mm_set1_ps(r.d.z);
+		__m128 e1x = _mm_loadu_ps(t.e1[0]), e1y = _mm_loadu_ps(t.e1[1]), e1z = _mm_loadu_ps(t.e1[2]);
+		__m128 e2x = _mm_loadu_ps(t.e2[0]), e2y = _mm_loadu_ps(t.e2[1]), e2z = _mm_loadu_ps(t.e2[2]);
+		//p = d x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+		//s = o - v0
+		__m128 sx = _mm_sub_ps(_mm_set1_ps(r.o.x), _mm_loadu_ps(t.v0[0]));
+		__m128 sy = _mm_sub_ps(_mm_set1_ps(r.o.y), _mm_loadu_ps(t.v0[1]));
+		__m128 sz = _mm_sub_ps(_mm_set1_ps(r.o.z), _mm_loadu_ps(t.v0[2]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+		//q = s x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+		__m128 tv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+		__m128 zero = _mm_setzero_ps();
+		__m128 m = _mm_cmpneq_ps(det, zero);
+		m = _mm_and_ps(m, _mm_cmpge_ps(u, zero));
+		m = _mm_and_ps(m, _mm_cmpge_ps(v, zero));
+		m = _mm_and_ps(m, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		m = _mm_and_ps(m, _mm_cmpgt_ps(tv, _mm_set1_ps(r.tmin)));
+		m = _mm_and_ps(m, _mm_cmplt_ps(tv, _mm_set1_ps(tmax)));
+		mask = _mm_movemask_ps(m);
+		_mm_storeu_ps(tt, tv);
+		_mm_storeu_ps(uu, u);
+		_mm_storeu_ps(vv, v);
+#else
+		for (int lane = 0; lane < 4; lane++)
+		{
+			glm::vec3 e1(t.e1[0][lane], t.e1[1][lane], t.e1[2][lane]);
+			glm::vec3 e2(t.e2[0][lane], t.e2[1][lane], t.e2[2][lane]);
+			glm::vec3 p = glm::cross(r.d, e2);
+			float det = glm::dot(e1, p);
+			if (det == 0.0f) {
+				continue;
+			}
+			float inv = 1.0f / det;
+			glm::vec3 s = r.o - glm::vec3(t.v0[0][lane], t.v0[1][lane], t.v0[2][lane]);
+			glm::vec3 q = glm::cross(s, e1);
+			uu[lane] = glm::dot(s, p) * inv;
+			vv[lane] = glm::dot(r.d, q) * inv;
+			tt[lane] = glm::dot(e2, q) * inv;
+			if (uu[lane] >= 0.0f && vv[lane] >= 0.0f && uu[lane] + vv[lane] <= 1.0f && tt[lane] > r.tmin && tt[lane] < tmax) {
+				mask |= 1 << lane;
+			}
+		}
+#endif
+		bool found = false;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if ((mask & (1 << lane)) && tt[lane] < hit.t) {
+				hit.t = tt[lane];
+				hit.u = uu[lane];
+				hit.v = vv[lane];
+				hit.face = block_faces[size_t(b) * 4 + lane];
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	const std::vector<vertex>* vertices = nullptr;
+	const std::vector<unsigned int>* indices = nullptr;
+
+	//build scratch
+	std::vector<unsigned int> faces;
+	std::vector<glm::vec3> cmin, cmax, centroid;
+	std::atomic<unsigned int> node_count;
+};
@@ -10,6 +10,9 @@
 #include <algorithm>
 #include "model.h"
 #include <algorithm>
+#include <cstdint>
+#include "parallel.h"
+#include "mc_bcn.h"
 
 #define ArrayCount(x) (sizeof(x)/sizeof(x[0]))
 
@@ -155,6 +158,31 @@ bool operator== (const rgb& lhs, const rgb& rhs) {
 	return ret;
 }
 
+//spreads the low 16 bits of v to the even bits
+uint32_t morton_spread(uint32_t v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+/* Storage of rect2D texels.
+   RECT_LINEAR keeps the linear index x*hei + y the rest of the code computes.
+   RECT_TILED keeps 32x32 tiles of 3KB, under a page each, tiles one after the other and
+   texels in Z order inside a tile, so the four bilinear taps and the samples of a face
+   share a handful of cache lines instead of one per column. Callers keep passing linear
+   indices, rect2D swizzles them. */
+enum rect_layout {
+	RECT_LINEAR,
+	RECT_TILED
+};
+
+const unsigned int rect_tile_bits = 5;
+const unsigned int rect_tile = 1 << rect_tile_bits;
+
 /* 2D rect custom texture*/
 class rect2D {
 public:
@@ -163,6 +191,7 @@ public:
 		hei = h;
 		size = wid * hei;
 		data.resize(size);
+		clear_occupancy();
 		build_data(file);
 	}
 
@@ -177,6 +206,71 @@ public:
 			data[i].c[1] = 0x00;
 			data[i].c[2] = 0x00;
 		}
+		clear_occupancy();
+	}
+
+	//position in data of the texel at linear index x*hei + y
+	size_t storage_index(unsigned int index) const
+	{
+		if (layout == RECT_LINEAR) {
+			return index;
+		}
+		unsigned int x = index / hei, y = index % hei;
+		size_t tile = size_t(x >> rect_tile_bits) * tiles_hei + (y >> rect_tile_bits);
+		return (tile << (2 * rect_tile_bits)) | (morton_spread(x & (rect_tile - 1)) << 1) | morton_spread(y & (rect_tile - 1));
+	}
+
+	rgb& at(unsigned int index) { return data[storage_index(index)]; }
+	const rgb& at(unsigned int index) const { return data[storage_index(index)]; }
+
+	//texels in linear order, as gl uploads and bmp export expect them
+	void to_linear(std::vector<rgb>& out) const
+	{
+		if (layout == RECT_LINEAR) {
+			out = data;
+			return;
+		}
+		out.resize(size_t(wid) * hei);
+		for_each_tiled([&](size_t l, size_t t) { out[l] = data[t]; });
+	}
+
+	//changes the storage, texels keep their linear indices
+	void set_layout(rect_layout l)
+	{
+		if (l == layout) {
+			return;
+		}
+		std::vector<rgb> linear;
+		to_linear(linear);
+		layout = l;
+		if (layout == RECT_LINEAR) {
+			data.swap(linear);
+			return;
+		}
+		tiles_hei = (hei + rect_tile - 1) / rect_tile;
+		size_t tiles = size_t((wid + rect_tile - 1) / rect_tile) * tiles_hei;
+		data.assign(tiles << (2 * rect_tile_bits), rgb(0, 0, 0));
+		for_each_tiled([&](size_t l, size_t t) { data[t] = linear[l]; });
+	}
+
+	//occupancy is kept per 8x8 tile of texels, one bit per texel, rows as gl uploads data
+	void clear_occupancy()
+	{
+		tiles_x = (wid + 7) / 8;
+		tiles_y = (hei + 7) / 8;
+		occupied.assign(size_t(tiles_x) * tiles_y, 0);
+	}
+
+	void mark_occupied(unsigned int index)
+	{
+		unsigned int x = index % wid, y = index / wid;
+		occupied[size_t(y / 8) * tiles_x + x / 8] |= uint64_t(1) << ((y % 8) * 8 + x % 8);
+	}
+
+	bool is_occupied(unsigned int index) const
+	{
+		unsigned int x = index % wid, y = index / wid;
+		return (occupied[size_t(y / 8) * tiles_x + x / 8] >> ((y % 8) * 8 + x % 8)) & 1;
 	}
 	
 	//Used if one needs to load images from disk
@@ -209,7 +303,9 @@ public:
 	//Save as bmp from previously loaded image
 	void export_bmp() {
 		//std::cout << "saving image" << std::endl;
-		int result = SOIL_save_image("rect2D.bmp", SOIL_SAVE_TYPE_BMP, (int)wid, (int)hei, (int)ch, reinterpret_cast<unsigned char*>(data.data()));
+		std::vector<rgb> linear;
+		to_linear(linear);
+		int result = SOIL_save_image("rect2D.bmp", SOIL_SAVE_TYPE_BMP, (int)wid, (int)hei, (int)ch, reinterpret_cast<unsigned char*>(linear.data()));
 		if (result == 0) {
 			std::cout << SOIL_last_result() << std::endl;				
 		}
@@ -218,7 +314,9 @@ public:
 	//Save bmp from custom image
 	void export_bmp2(const char* name = "rect2D.bmp") {
 		//std::cout << "saving image " << name << std::endl;
-		int result = SOIL_save_image(name, SOIL_SAVE_TYPE_BMP, (int)wid, (int)hei, 3, reinterpret_cast<unsigned char*>(data.data()));
+		std::vector<rgb> linear;
+		to_linear(linear);
+		int result = SOIL_save_image(name, SOIL_SAVE_TYPE_BMP, (int)wid, (int)hei, 3, reinterpret_cast<unsigned char*>(linear.data()));
 		if (result == 0) {
 			std::cout << SOIL_last_result() << std::endl;
 		}
@@ -234,7 +332,8 @@ public:
 		//	std::cout << "index out of range" << std::endl;
 		//}
 		assert(index >= 0 && index <= size);
-		data[index] = v;
+		at(index) = v;
+		mark_occupied(index);
 	}
 
 	//normalized at
@@ -250,7 +349,8 @@ public:
 		}
 		else
 		{
-			data[index] = v;
+			at(index) = v;
+			mark_occupied(index);
 		}
 	}
 
@@ -264,14 +364,32 @@ public:
 		}
 		else
 		{
-			data[index] = v;
+			at(index) = v;
+			mark_occupied(index);
 		}
 	}
 		
+	//calls fn(linear index, storage index) for every texel, one tile column per task
+	template<typename F>
+	void for_each_tiled(F fn) const
+	{
+		unsigned int columns = (wid + rect_tile - 1) / rect_tile;
+		parallel_blocks(0, columns, worker_count(), [&](size_t c0, size_t c1, unsigned int) {
+			for (unsigned int x = unsigned(c0) * rect_tile; x < std::min(wid, unsigned(c1) * rect_tile); x++)
+			{
+				size_t column = (size_t(x >> rect_tile_bits) * tiles_hei) << (2 * rect_tile_bits);
+				uint32_t mx = morton_spread(x & (rect_tile - 1)) << 1;
+				for (unsigned int y = 0; y < hei; y++) {
+					fn(size_t(x) * hei + y, column + (size_t(y >> rect_tile_bits) << (2 * rect_tile_bits)) + (mx | morton_spread(y & (rect_tile - 1))));
+				}
+			}
+		});
+	}
+
 	rgb get_pixel_from_uv(double u, double v)
 	{
 		unsigned int index = u * hei + v;
-		return data[index];
+		return at(index);
 	}
 	//bilinear
 	//https://en.wikipedia.org/wiki/Bilinear_filtering
@@ -297,8 +415,102 @@ public:
 	unsigned int hei;
 	unsigned int ch;
 	unsigned int size;
+	rect_layout layout = RECT_LINEAR;
+	//tiles along y when tiled
+	unsigned int tiles_hei = 0;
+	//texels written through the insert functions
+	std::vector<uint64_t> occupied;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
 };
 
+/* Fills the texels around the written ones so bilinear reads next to a sample do not pull
+   in unrelated colors. Every pass gives each unwritten texel touching a written or filled
+   one the mean of those neighbours. Only tiles that are not full and have a non empty tile
+   around them are visited, the cost follows the written area, not the image. */
+void dilate_gutters(rect2D& r, unsigned int passes = 4)
+{
+	unsigned int tx = r.tiles_x, ty = r.tiles_y;
+	std::vector<uint64_t> mask = r.occupied, next;
+	//8 bits of row y of tile (x, y / 8), zero outside the image
+	auto tile_row = [&](int x, int y) -> unsigned int {
+		if (x < 0 || y < 0 || x >= int(tx) || y >= int(r.hei)) {
+			return 0;
+		}
+		return (unsigned int)(mask[size_t(y / 8) * tx + x] >> ((y % 8) * 8)) & 0xFF;
+	};
+
+	for (unsigned int p = 0; p < passes; p++)
+	{
+		next = mask;
+		std::atomic<bool> grew(false);
+		parallel_blocks(0, ty, worker_count(), [&](size_t y0, size_t y1, unsigned int) {
+			for (unsigned int y = (unsigned int)y0; y < y1; y++) {
+				for (unsigned int x = 0; x < tx; x++)
+				{
+					//nothing to fill in a full tile, nothing to fill from around an empty one
+					uint64_t word = mask[size_t(y) * tx + x];
+					if (word == ~uint64_t(0)) {
+						continue;
+					}
+					bool near = word != 0;
+					for (unsigned int ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, ty - 1) && !near; ny++) {
+						for (unsigned int nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, tx - 1) && !near; nx++) {
+							near = mask[size_t(ny) * tx + nx] != 0;
+						}
+					}
+					if (!near) {
+						continue;
+					}
+					//bits of the tile and its one texel ring, bit c of rows[k] is texel (8x + c - 1, 8y + k - 1)
+					unsigned int rows[10];
+					for (int k = 0; k < 10; k++)
+					{
+						int gy = int(y * 8) + k - 1;
+						rows[k] = (tile_row(int(x) - 1, gy) >> 7) | (tile_row(int(x), gy) << 1) | ((tile_row(int(x) + 1, gy) & 1) << 9);
+					}
+					unsigned int w = std::min(8u, r.wid - x * 8), h = std::min(8u, r.hei - y * 8);
+					for (unsigned int ly = 0; ly < h; ly++)
+					{
+						//empty texels of the row with a written neighbour
+						unsigned int around = 0;
+						for (int k = 0; k < 3; k++) {
+							around |= rows[ly + k] | (rows[ly + k] << 1) | (rows[ly + k] >> 1);
+						}
+						unsigned int todo = (around & ~rows[ly + 1]) >> 1 & ((1u << w) - 1);
+						for (unsigned int lx = 0; todo; lx++, todo >>= 1)
+						{
+							if (!(todo & 1)) {
+								continue;
+							}
+							//texels filled this pass only read texels written before it
+							int px = int(x * 8 + lx), py = int(y * 8 + ly);
+							int sum[3] = { 0, 0, 0 }, n = 0;
+							for (int dy = -1; dy <= 1; dy++) {
+								unsigned int nb = (rows[ly + 1 + dy] >> lx) & 7;
+								for (int dx = -1; dx <= 1; dx++) {
+									if ((nb >> (dx + 1)) & 1) {
+										const rgb& c = r.at(unsigned(py + dy) * r.wid + px + dx);
+										for (int k = 0; k < 3; k++) sum[k] += c.c[k];
+										n++;
+									}
+								}
+							}
+							r.at(unsigned(py) * r.wid + px) = rgb((sum[0] + n / 2) / n, (sum[1] + n / 2) / n, (sum[2] + n / 2) / n);
+							next[size_t(y) * tx + x] |= uint64_t(1) << (ly * 8 + lx);
+							grew = true;
+						}
+					}
+				}
+			}
+		});
+		mask.swap(next);
+		if (!grew) {
+			break;
+		}
+	}
+}
+
 /* Fullscreen quad */
 struct quad {
 	GLuint vao;
@@ -395,7 +607,7 @@ struct rface {
 		edge_r = R - 1;
 		
 		v_index.resize(3);
-		f_index.resize(face_r);
+		f_index.reserve(face_r);
 
 		tri[0] = i1;
 		tri[1] = i2;
@@ -661,38 +873,38 @@ public:
 			int face_res = faces[i].face_r;
 			int edge_res = faces[i].edge_r;
 			
-			for (int a = 0; a <= _R; a++) {
-				for (int b = 0; b <= (_R - a); b++) {
-					if ((a == 0 && b == 0) || (a == _R && b == 0) || (a == 0 && b == _R)) {
+			for (int p = 0; p <= _R; p++) {
+				for (int q = 0; q <= (_R - p); q++) {
+					if ((p == 0 && q == 0) || (p == _R && q == 0) || (p == 0 && q == _R)) {
 						continue;
 					}
 
-					if (a == 0 && (b > 0 && b < _R)) {
+					if (p == 0 && (q > 0 && q < _R)) {
 						//C0k
-						bary = glm::vec3((double)a / _R, (double)b / _R, 1.0 - ((double)a + (double)b) / _R);
+						bary = glm::vec3((double)p / _R, (double)q / _R, 1.0 - ((double)p + (double)q) / _R);
 						coords = barycentric_to_cartesian(bary.x, bary.y, bary.z, vertices[a].uv, vertices[b].uv, vertices[c].uv);
 						x = ilerp(0, wid, coords.x);
 						y = ilerp(0, hei, coords.y);
 						faces[i].e_index[0].emplace_back((x*hei) + y);
 					}
-					else if ((a > 0 && a < _R) && b == 0) {
+					else if ((p > 0 && p < _R) && q == 0) {
 						//Ck0
-						bary = glm::vec3((double)a / _R, (double)b / _R, 1.0 - ((double)a + (double)b) / _R);
+						bary = glm::vec3((double)p / _R, (double)q / _R, 1.0 - ((double)p + (double)q) / _R);
 						coords = barycentric_to_cartesian(bary.x, bary.y, bary.z, vertices[a].uv, vertices[b].uv, vertices[c].uv);
 						x = ilerp(0, wid, coords.x);
 						y = ilerp(0, hei, coords.y);
 						faces[i].e_index[1].emplace_back((x*hei) + y);
 					}
-					else if (((a > 0 && a < _R)) && b == (_R - a)) {
+					else if (((p > 0 && p < _R)) && q == (_R - p)) {
 						//Ck(R-k)
-						bary = glm::vec3((double)a / _R, (double)b / _R, 1.0 - ((double)a + (double)b) / _R);
+						bary = glm::vec3((double)p / _R, (double)q / _R, 1.0 - ((double)p + (double)q) / _R);
 						coords = barycentric_to_cartesian(bary.x, bary.y, bary.z, vertices[a].uv, vertices[b].uv, vertices[c].uv);
 						x = ilerp(0, wid, coords.x);
 						y = ilerp(0, hei, coords.y);
 						faces[i].e_index[2].emplace_back((x*hei) + y);
 					}
 					else {
-						bary = glm::vec3((double)a / _R, (double)b / _R, 1.0 - ((double)a + (double)b) / _R);
+						bary = glm::vec3((double)p / _R, (double)q / _R, 1.0 - ((double)p + (double)q) / _R);
 						coords = barycentric_to_cartesian(bary.x, bary.y, bary.z, vertices[a].uv, vertices[b].uv, vertices[c].uv);
 						x = ilerp(0, wid, coords.x);
 						y = ilerp(0, hei, coords.y);
@@ -747,12 +959,7 @@ void build_mesh_color_texture(mesh_colors& m, rect2D& r)
 		r.insert_1D(f.e_index[1], m.image[f.e_index[1]]);
 		r.insert_1D(f.e_index[2], m.image[f.e_index[2]]);
 	}
-	for (size_t i = 0; i < r.data.size(); i++)
-	{
-		if (r.data[i].r == 0 && r.data[i].g == 0 && r.data[i].b == 0) {
-			r.data[i] = rgb(246 , 164, 180);
-		}
-	}
+	dilate_gutters(r);
 }
 
 void custom_mesh_color_texture(mesh_colors2& m, rect2D& r)
@@ -779,13 +986,8 @@ void custom_mesh_color_texture(mesh_colors2& m, rect2D& r)
 
 	}
 	
-	//kirby fix
-	for (size_t i = 0; i < r.data.size(); i++)
-	{
-		if ((r.data[i].r == 0) && (r.data[i].g == 0) && (r.data[i].b == 0)) {
-			r.data[i] = rgb(246, 164, 180);
-		}
-	}
+	//unwritten texels next to the samples take their colors, black samples stay black
+	dilate_gutters(r);
 
 }
 
@@ -832,9 +1034,67 @@ void gen_rectangle_texture(const rect2D& r, GLuint& id)
 {
 	GLCall(glGenTextures(1, &id));
 	GLCall(glBindTexture(GL_TEXTURE_2D, id));
-	GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, r.wid, r.hei, 0, GL_RGB, GL_UNSIGNED_BYTE, r.data.data()));
+	std::vector<rgb> linear;
+	if (r.layout == RECT_TILED) {
+		r.to_linear(linear);
+	}
+	GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, r.wid, r.hei, 0, GL_RGB, GL_UNSIGNED_BYTE, r.layout == RECT_TILED ? linear.data() : r.data.data()));
 	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
 	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
 	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
 	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));	
 }
+
+//bc1 copy of r with a full mip chain, a sixth of the memory of gen_rectangle_texture
+//the encoding is reused from cache_path while r holds the same texels
+void gen_bcn_rectangle_texture(const rect2D& r, GLuint& id, const char* cache_path)
+{
+	GLCall(glGenTextures(1, &id));
+	std::vector<rgb> linear;
+	r.to_linear(linear);
+	bcn_image img;
+	load_or_encode_bcn(linear[0].c, r.wid, r.hei, 3, true, cache_path, img);
+	upload_bcn_texture(img, id);
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+}
+
+//re-encodes every texel of a texture made by gen_bcn_rectangle_texture, the cache is left as it is
+void update_bcn_rectangle_texture(const rect2D& r, GLuint id)
+{
+	std::vector<rgb> linear;
+	r.to_linear(linear);
+	bcn_image img;
+	encode_bcn(linear[0].c, r.wid, r.hei, 3, true, img);
+	upload_bcn_texture(img, id);
+}
+
+//re-uploads the texels [x, x+w) x [y, y+h) of a texture made by gen_rectangle_texture
+void update_rectangle_texture(const rect2D& r, GLuint id, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	GLCall(glBindTexture(GL_TEXTURE_2D, id));
+	if (r.layout == RECT_TILED) {
+		//gather the rows of the rectangle, gl reads rows of wid texels
+		std::vector<rgb> rows(size_t(w) * h);
+		for (unsigned int j = 0; j < h; j++) {
+			for (unsigned int i = 0; i < w; i++) {
+				rows[size_t(j) * w + i] = r.at((y + j) * r.wid + x + i);
+			}
+		}
+		GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+		GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, rows.data()));
+		GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+		return;
+	}
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+	GLCall(glPixelStorei(GL_UNPACK_ROW_LENGTH, r.wid));
+	GLCall(glPixelStorei(GL_UNPACK_SKIP_PIXELS, x));
+	GLCall(glPixelStorei(GL_UNPACK_SKIP_ROWS, y));
+	GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, r.data.data()));
+	GLCall(glPixelStorei(GL_UNPACK_SKIP_ROWS, 0));
+	GLCall(glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0));
+	GLCall(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <iostream>
+#include <cstddef>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Read only memory mapped file.
+   Pages are loaded on demand and can be dropped again with release(), so reading a file
+   through it costs address space, not heap. */
+class mapped_file {
+public:
+	enum access_hint {
+		SEQUENTIAL,
+		RANDOM
+	};
+
+	mapped_file() {}
+	mapped_file(const char* path, access_hint hint = SEQUENTIAL) { open(path, hint); }
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool open(const char* path, access_hint hint = SEQUENTIAL)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			hint == SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			std::cout << "failed to open mapped file: " << path << std::endl;
+			return false;
+		}
+		LARGE_INTEGER sz;
+		GetFileSizeEx(file, &sz);
+		bytes = (size_t)sz.QuadPart;
+		if (bytes > 0) {
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL) {
+				ptr = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			}
+		}
+#else
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0) {
+			std::cout << "failed to open mapped file: " << path << std::endl;
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		bytes = (size_t)st.st_size;
+		if (bytes > 0) {
+			void* p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED) {
+				ptr = (const unsigned char*)p;
+				madvise(p, bytes, hint == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+			}
+		}
+#endif
+		if (bytes > 0 && ptr == nullptr) {
+			std::cout << "failed to map file: " << path << std::endl;
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (ptr) UnmapViewOfFile(ptr);
+		if (mapping != NULL) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (ptr) munmap((void*)ptr, bytes);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		ptr = nullptr;
+		bytes = 0;
+	}
+
+	//hints the os that [offset, offset + size) is no longer needed, pages are read back on next access
+	void release(size_t offset, size_t size)
+	{
+		if (ptr == nullptr || offset >= bytes) {
+			return;
+		}
+		size = std::min(size, bytes - offset);
+		//only whole pages inside the range can go
+		size_t page = page_size();
+		size_t b0 = (offset + page - 1) / page * page;
+		size_t b1 = (offset + size) / page * page;
+		if (b1 <= b0) {
+			return;
+		}
+#ifdef _WIN32
+		//unlocking pages that are not locked trims them from the working set
+		VirtualUnlock((LPVOID)(ptr + b0), b1 - b0);
+#else
+		madvise((void*)(ptr + b0), b1 - b0, MADV_DONTNEED);
+#endif
+	}
+
+	static size_t page_size()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return si.dwPageSize;
+#else
+		return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	bool is_open() const { return valid(); }
+	const unsigned char* data() const { return ptr; }
+	size_t size() const { return bytes; }
+
+private:
+	bool valid() const
+	{
+#ifdef _WIN32
+		return file != INVALID_HANDLE_VALUE;
+#else
+		return fd >= 0;
+#endif
+	}
+
+	const unsigned char* ptr = nullptr;
+	size_t bytes = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
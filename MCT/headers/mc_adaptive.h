@@ -0,0 +1,174 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cmath>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_filter.h"
+#include "topology.h"
+#include "parallel.h"
+
+/* Mesh colors with a resolution per face.
+   mesh_colors2 gives every face the same R = 2^r - 1, so small triangles carry as many
+   samples as large ones. Here each face gets its own R, any value, from the texels its uv
+   triangle covers, and its patch keeps the usual per face layout at that R. Patches are
+   found through a prefix sum of their sizes.
+   A shared edge is sampled at R_e, the smaller R of its two faces, and both faces fill their
+   boundary by interpolating those same R_e knots, so neighbours follow the same colors
+   along the edge: exactly when R_e divides the face R, within one interpolation step
+   between knots otherwise.
+   Vertices read the texel under them like fill_colors_alt does. */
+
+struct mc_adaptive_config {
+	//samples per texel of uv area
+	float density = 1.0f;
+	unsigned int min_R = 1;
+	unsigned int max_R = 31;
+};
+
+struct mc_adaptive_buffer {
+	//per face resolution
+	std::vector<unsigned int> face_r;
+	//per undirected edge resolution, indexed by mesh_topology::edge
+	std::vector<unsigned int> edge_r;
+	//face f owns colors[offsets[f] .. offsets[f + 1])
+	std::vector<size_t> offsets;
+	std::vector<rgb> colors;
+	dirty_ranges dirty;
+
+	unsigned int face_count() const { return (unsigned int)face_r.size(); }
+	unsigned int R(unsigned int f) const { return face_r[f]; }
+	size_t face_offset(unsigned int f) const { return offsets[f]; }
+	rgb* face(unsigned int f) { return colors.data() + offsets[f]; }
+	const rgb* face(unsigned int f) const { return colors.data() + offsets[f]; }
+
+	//lays out patches for the resolutions in face_r
+	void layout()
+	{
+		offsets.resize(face_r.size() + 1);
+		parallel_for(0, face_r.size(), [&](size_t f) { offsets[f] = mc_face_samples(face_r[f]); });
+		offsets.back() = 0;
+		size_t total = prefix_sum(offsets);
+		offsets.back() = total;
+		colors.resize(total);
+	}
+
+	void mark_dirty(unsigned int f0, unsigned int f1)
+	{
+		dirty.add(offsets[f0], offsets[f1]);
+	}
+};
+
+//resolution giving a face about density samples per covered texel
+unsigned int texel_density_r(const glm::vec2& t0, const glm::vec2& t1, const glm::vec2& t2, const mc_adaptive_config& cfg)
+{
+	//a patch of resolution R holds about R^2 / 2 samples
+	float area = 0.5f * std::fabs((t1.x - t0.x) * (t2.y - t0.y) - (t2.x - t0.x) * (t1.y - t0.y));
+	unsigned int R = (unsigned int)std::ceil(std::sqrt(2.0f * area * cfg.density));
+	//a face needs R >= 1, R = 0 would write its corners into the next face
+	unsigned int lo = std::max(1u, cfg.min_R);
+	return std::min(std::max(lo, cfg.max_R), std::max(lo, R));
+}
+
+//face resolutions from uv density, then every edge takes the smaller resolution of its faces
+void choose_resolutions(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, const mesh_topology& topo,
+	unsigned int wid, unsigned int hei, const mc_adaptive_config& cfg, mc_adaptive_buffer& out)
+{
+	unsigned int faces = (unsigned int)(inds.size() / 3);
+	glm::vec2 size(wid, hei);
+	out.face_r.resize(faces);
+	parallel_for(0, faces, [&](size_t f) {
+		out.face_r[f] = texel_density_r(verts[inds[3 * f + 0]].uv * size, verts[inds[3 * f + 1]].uv * size,
+			verts[inds[3 * f + 2]].uv * size, cfg);
+	});
+	out.edge_r.resize(topo.edge_count());
+	parallel_for(0, topo.edge_count(), [&](size_t e) {
+		unsigned int h = topo.edge_half_edge[e];
+		unsigned int r = out.face_r[h / 3];
+		if (topo.twin[h] != NO_HALF_EDGE) {
+			r = std::min(r, out.face_r[topo.twin[h] / 3]);
+		}
+		out.edge_r[e] = r;
+	});
+	out.layout();
+}
+
+/* Fills out, whose resolutions come from choose_resolutions, from the texture in sat.
+   Interior samples average their footprint at the face resolution, edge knots at the edge
+   resolution. */
+void build_mc_adaptive(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, const mesh_topology& topo,
+	const summed_area_table& sat, mc_adaptive_buffer& out)
+{
+	unsigned int faces = out.face_count();
+	if (faces == 0 || sat.wid == 0 || sat.hei == 0) {
+		return;
+	}
+	glm::vec2 size(sat.wid, sat.hei);
+
+	parallel_blocks(0, faces, worker_count() * 4, [&](size_t f0, size_t f1, unsigned int) {
+		std::vector<glm::vec3> knots;
+		for (size_t fi = f0; fi < f1; fi++)
+		{
+			unsigned int f = (unsigned int)fi;
+			unsigned int R = out.face_r[f];
+			glm::vec2 t[3];
+			for (int k = 0; k < 3; k++) {
+				t[k] = verts[inds[3 * f + k]].uv * size;
+			}
+			rgb* dst = out.face(f);
+			auto store = [](rgb& c, glm::vec3 v) {
+				v += 0.5f;
+				c = rgb(int(v.x), int(v.y), int(v.z));
+			};
+
+			//corners
+			glm::vec3 corner[3];
+			for (int k = 0; k < 3; k++) {
+				corner[k] = footprint_mean(sat, t[k], glm::vec2(0.0f));
+				store(dst[k], corner[k]);
+			}
+
+			//edges k -> k+1, the order of half-edges 3f + k and of the patch edge blocks
+			unsigned int e_samples = mc_edge_samples(R);
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int Re = out.edge_r[topo.edge[3 * f + k]];
+				glm::vec2 a = t[k], b = t[(k + 1) % 3];
+				glm::vec2 half = 0.5f * glm::abs(b - a) / float(Re);
+				knots.resize(Re + 1);
+				knots[0] = corner[k];
+				knots[Re] = corner[(k + 1) % 3];
+				for (unsigned int m = 1; m < Re; m++) {
+					knots[m] = footprint_mean(sat, glm::mix(a, b, float(m) / Re), half);
+				}
+				rgb* edge = dst + 3 + k * e_samples;
+				for (unsigned int s = 0; s < e_samples; s++)
+				{
+					float x = float(s + 1) * Re / R;
+					unsigned int m = std::min((unsigned int)x, Re - 1);
+					store(edge[s], glm::mix(knots[m], knots[m + 1], x - m));
+				}
+			}
+
+			//interior
+			glm::vec2 d1 = (t[1] - t[0]) / float(R);
+			glm::vec2 d2 = (t[2] - t[0]) / float(R);
+			glm::vec2 half = 0.5f * glm::max(glm::abs(d1), glm::max(glm::abs(d2), glm::abs(d2 - d1)));
+			unsigned int spf = mc_face_samples(R);
+			for (unsigned int s = 3 + 3 * e_samples; s < spf; s++)
+			{
+				glm::vec3 w = mc_slot_bary(R, s);
+				store(dst[s], footprint_mean(sat, t[0] * w.x + t[1] * w.y + t[2] * w.z, half));
+			}
+		}
+	});
+	out.dirty.clear();
+	out.dirty.add(0, out.colors.size());
+}
+
+//color at barycentric weights w of face f
+glm::vec3 mc_eval(const mc_adaptive_buffer& b, unsigned int f, const glm::vec3& w)
+{
+	return mc_eval_patch(b.face(f), b.face_r[f], w);
+}
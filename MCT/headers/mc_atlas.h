@@ -0,0 +1,232 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_adaptive.h"
+#include "parallel.h"
+
+/* Packed 2D atlas of mesh colors patches, read with hardware bilinear filtering.
+   Sample (i, j, k) of a patch goes to texel (j, k) of a right triangle, v0 at the origin.
+   Two faces of the same R share a (R+3) x (R+2) block, the second one turned half a turn:
+
+       y  A B B B B      texels x + y <= R+1 belong to face A, the others to face B,
+          A A B B B      the diagonal x + y = R+1 (A) and x + y = R+2 (B) is a one texel
+          A A A B B      border past the last row of samples. Bilinear reads from the
+          A A A A B  x   triangle never leave it: the cell at the hypotenuse reads one
+                         border texel, which holds the parallelogram completion of the
+         (R = 2)         other three so the lower half of the cell is linear (as long as
+                         the completion fits in 0..255, very low R can clamp).
+   Corners sit on texel centers, the legs need no border.
+   Blocks are sorted by height and laid on shelves, with a single R every block is the same
+   size and the atlas is filled but for the end of the last shelf. */
+
+//where face f lives: block origin and whether it is the turned face of the block
+struct mc_atlas_slot {
+	unsigned int x = 0;
+	unsigned int y = 0;
+	unsigned int R = 0;
+	bool turned = false;
+};
+
+struct mc_atlas {
+	unsigned int wid = 0;
+	unsigned int hei = 0;
+	//row major, texel (x, y) at texels[y * wid + x]
+	std::vector<rgb> texels;
+	std::vector<mc_atlas_slot> slots;
+	//area of all blocks, fill rate is used / (wid * hei)
+	size_t used = 0;
+
+	float fill_rate() const { return wid * hei > 0 ? float(used) / (float(wid) * float(hei)) : 0.0f; }
+
+	//texel of sample (i, j, k) of the face in slot s, also valid on the border j + k = R+1
+	glm::uvec2 texel(const mc_atlas_slot& s, unsigned int j, unsigned int k) const
+	{
+		if (s.turned) {
+			return glm::uvec2(s.x + s.R + 2 - j, s.y + s.R + 1 - k);
+		}
+		return glm::uvec2(s.x + j, s.y + k);
+	}
+
+	//normalized atlas coordinates of corner c of face f, on the texel center
+	glm::vec2 corner_uv(unsigned int f, unsigned int c) const
+	{
+		const mc_atlas_slot& s = slots[f];
+		glm::uvec2 t = texel(s, c == 1 ? s.R : 0, c == 2 ? s.R : 0);
+		return (glm::vec2(t) + 0.5f) / glm::vec2(wid, hei);
+	}
+};
+
+/* Places the faces of resolutions face_r in blocks. Faces of the same R are paired in index
+   order, blocks go on shelves of a width that makes the atlas about square. */
+void pack_mc_atlas(const std::vector<unsigned int>& face_r, mc_atlas& out)
+{
+	unsigned int faces = (unsigned int)face_r.size();
+	out.slots.assign(faces, mc_atlas_slot());
+	out.used = 0;
+	if (faces == 0) {
+		out.wid = out.hei = 0;
+		out.texels.clear();
+		return;
+	}
+
+	//faces by decreasing R, so each shelf holds blocks of one height
+	std::vector<unsigned int> order(faces);
+	for (unsigned int f = 0; f < faces; f++) {
+		order[f] = f;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return face_r[a] > face_r[b]; });
+
+	//faces a and b, b == faces when a has no partner
+	struct block {
+		unsigned int a, b, R;
+	};
+	std::vector<block> blocks;
+	for (unsigned int i = 0; i < faces; i++)
+	{
+		unsigned int f = order[i];
+		if (i + 1 < faces && face_r[order[i + 1]] == face_r[f]) {
+			blocks.push_back({ f, order[i + 1], face_r[f] });
+			i++;
+		}
+		else {
+			blocks.push_back({ f, faces, face_r[f] });
+		}
+	}
+	unsigned int max_w = 0;
+	for (const block& b : blocks)
+	{
+		out.used += size_t(b.R + 3) * (b.R + 2);
+		max_w = std::max(max_w, b.R + 3);
+	}
+	//a whole number of the widest blocks
+	unsigned int side = (unsigned int)std::ceil(std::sqrt(double(out.used)));
+	out.wid = ((side + max_w - 1) / max_w) * max_w;
+
+	//shelves
+	unsigned int x = 0, y = 0, shelf = 0;
+	for (const block& b : blocks)
+	{
+		unsigned int w = b.R + 3, h = b.R + 2;
+		if (x + w > out.wid) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		mc_atlas_slot s;
+		s.x = x;
+		s.y = y;
+		s.R = b.R;
+		out.slots[b.a] = s;
+		if (b.b < faces) {
+			s.turned = true;
+			out.slots[b.b] = s;
+		}
+		x += w;
+		shelf = std::max(shelf, h);
+	}
+	out.hei = y + shelf;
+	out.texels.assign(size_t(out.wid) * out.hei, rgb(0, 0, 0));
+}
+
+namespace {
+	//writes the patch src of the face in slot s, then its border
+	void atlas_write_patch(mc_atlas& a, const mc_atlas_slot& s, const rgb* src)
+	{
+		unsigned int R = s.R;
+		auto at = [&](unsigned int j, unsigned int k) -> rgb& {
+			glm::uvec2 t = a.texel(s, j, k);
+			return a.texels[size_t(t.y) * a.wid + t.x];
+		};
+		for (unsigned int k = 0; k <= R; k++) {
+			for (unsigned int j = 0; j + k <= R; j++) {
+				at(j, k) = src[mc_grid_slot(R, R - j - k, j, k)];
+			}
+		}
+		//border (j, k), j + k = R+1: c(j, k-1) + c(j-1, k) - c(j-1, k-1)
+		at(R + 1, 0) = at(R, 0);
+		at(0, R + 1) = at(0, R);
+		for (unsigned int j = 1; j <= R; j++)
+		{
+			unsigned int k = R + 1 - j;
+			const rgb& a0 = at(j, k - 1);
+			const rgb& a1 = at(j - 1, k);
+			const rgb& a2 = at(j - 1, k - 1);
+			rgb c;
+			for (int n = 0; n < 3; n++) {
+				c.c[n] = (unsigned char)std::min(255, std::max(0, int(a0.c[n]) + int(a1.c[n]) - int(a2.c[n])));
+			}
+			at(j, k) = c;
+		}
+	}
+};
+
+//copies the patches of b into an atlas packed for its faces
+void fill_mc_atlas(const mc_buffer& b, mc_atlas& out)
+{
+	parallel_for(0, b.face_count, [&](size_t f) {
+		atlas_write_patch(out, out.slots[f], b.face((unsigned int)f));
+	});
+}
+
+void fill_mc_atlas(const mc_adaptive_buffer& b, mc_atlas& out)
+{
+	parallel_for(0, b.face_count(), [&](size_t f) {
+		atlas_write_patch(out, out.slots[f], b.face((unsigned int)f));
+	});
+}
+
+//packs and fills an atlas for b
+void build_mc_atlas(const mc_buffer& b, mc_atlas& out)
+{
+	pack_mc_atlas(std::vector<unsigned int>(b.face_count, b.R), out);
+	fill_mc_atlas(b, out);
+}
+
+void build_mc_atlas(const mc_adaptive_buffer& b, mc_atlas& out)
+{
+	pack_mc_atlas(b.face_r, out);
+	fill_mc_atlas(b, out);
+}
+
+//one render vertex per face corner, uv replaced by the atlas coordinates of the corner
+void build_atlas_mesh(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, const mc_atlas& a,
+	std::vector<vertex>& out_verts, std::vector<unsigned int>& out_inds)
+{
+	out_verts.resize(inds.size());
+	out_inds.resize(inds.size());
+	parallel_for(0, inds.size(), [&](size_t i) {
+		out_verts[i] = verts[inds[i]];
+		out_verts[i].uv = a.corner_uv(unsigned(i / 3), unsigned(i % 3));
+		out_inds[i] = unsigned(i);
+	});
+}
+
+//atlas texture, bilinear and clamped, like gen_rectangle_texture otherwise
+void gen_atlas_texture(const mc_atlas& a, GLuint& id)
+{
+	GLCall(glGenTextures(1, &id));
+	GLCall(glBindTexture(GL_TEXTURE_2D, id));
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+	GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, a.wid, a.hei, 0, GL_RGB, GL_UNSIGNED_BYTE, a.texels.data()));
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+}
+
+//re-uploads every texel of an atlas made by gen_atlas_texture
+void update_atlas_texture(const mc_atlas& a, GLuint id)
+{
+	GLCall(glBindTexture(GL_TEXTURE_2D, id));
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+	GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, a.wid, a.hei, GL_RGB, GL_UNSIGNED_BYTE, a.texels.data()));
+	GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <vector>
+#include <cstdint>
+
+/* Bcn textures, encoded on the cpu before upload.
+   Images with three channels become bc1 (8 bytes per 4x4 texels, 1/6 of rgb8), images
+   with alpha bc3 (16 bytes per 4x4 texels, 1/4 of rgba8). Every level of the mip chain is
+   box filtered from the one above and encoded on all workers, 4x4 blocks with the shared
+   block encoder of bc1_encode.h. Encoding a large texture takes a while, so the result
+   is cached in a file next to the source and reused while the pixels hash the same.
+   Compiled in mc_bcn.cpp, mesh_loader.cpp and main.cpp both use it. */
+
+enum bcn_format {
+	BCN_BC1,
+	BCN_BC3
+};
+
+struct bcn_level {
+	unsigned int wid = 0;
+	unsigned int hei = 0;
+	//blocks row by row, top row of the image first like the source
+	std::vector<unsigned char> blocks;
+};
+
+struct bcn_image {
+	bcn_format format = BCN_BC1;
+	std::vector<bcn_level> levels;
+
+	unsigned int block_bytes() const { return format == BCN_BC1 ? 8 : 16; }
+	size_t bytes() const
+	{
+		size_t n = 0;
+		for (const bcn_level& l : levels) {
+			n += l.blocks.size();
+		}
+		return n;
+	}
+};
+
+//64 bit hash of the pixels and their size, keys the disk cache
+uint64_t bcn_source_hash(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels);
+
+//encodes w x h pixels of 3 (bc1) or 4 (bc3) channels, rows of w * channels bytes, with or without mips
+void encode_bcn(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels, bool mips, bcn_image& out);
+
+//level of img back to rgba8, for exports and checks
+void decode_bcn(const bcn_image& img, unsigned int level, std::vector<unsigned char>& rgba);
+
+bool save_bcn(const bcn_image& img, uint64_t hash, const char* path);
+
+//false when the file is missing, damaged or was made from other pixels
+bool load_bcn(const char* path, uint64_t hash, bcn_image& out);
+
+//the cached encoding of pixels if there is one, otherwise encodes them and writes the cache
+void load_or_encode_bcn(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels, bool mips,
+	const char* cache_path, bcn_image& out);
+
+//true if the driver takes s3tc textures
+bool bcn_supported();
+
+//uploads every level of img to the 2d texture id, sampler state is left to the caller
+void upload_bcn_texture(const bcn_image& img, GLuint id);
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "parallel.h"
+#include "bc1_encode.h"
+
+/* Block compressed mesh colors, 8 bytes per 16 samples.
+   The samples of a patch are walked row by row of the lattice (i = 0, 1 .. R), each row in
+   the opposite direction of the one before, so consecutive samples are always neighbours,
+   and cut in runs of 16. A run is stored like a bc1 block: two rgb565 endpoints and a 2 bit
+   index per sample picking one of the four colors evenly spaced between them. Every face
+   takes the same number of blocks, face f starts at block f * blocks_per_face, so any
+   sample is decoded on its own, the mesh_colors_block shader does exactly that.
+   A patch of R = 7 (36 samples, 3 blocks) costs 5.3 bits per sample, R = 15 (136 samples,
+   9 blocks) 4.2 bits. */
+
+struct mc_compressed {
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	unsigned int blocks_per_face = 0;
+	std::vector<mc_block> blocks;
+
+	const mc_block* face(unsigned int f) const { return blocks.data() + size_t(f) * blocks_per_face; }
+	float bits_per_sample() const
+	{
+		return face_count ? float(blocks.size() * sizeof(mc_block) * 8) / (float(face_count) * mc_face_samples(R)) : 0.0f;
+	}
+};
+
+//position in the walk of grid coordinates (i, j, R - i - j)
+unsigned int mc_block_position(unsigned int R, unsigned int i, unsigned int j)
+{
+	unsigned int start = i * (R + 1) - (i * (i - 1)) / 2;
+	return start + ((i & 1) ? R - i - j : j);
+}
+
+//color m of the four a block can pick, the same integer math as the shader
+rgb mc_block_color(const mc_block& b, unsigned int m)
+{
+	int e[2][3];
+	for (int n = 0; n < 2; n++)
+	{
+		unsigned int c = (b.endpoints >> (16 * n)) & 0xFFFF;
+		unsigned int r = c >> 11, g = (c >> 5) & 63, bl = c & 31;
+		e[n][0] = int((r << 3) | (r >> 2));
+		e[n][1] = int((g << 2) | (g >> 4));
+		e[n][2] = int((bl << 3) | (bl >> 2));
+	}
+	int k = int((b.indices >> (2 * m)) & 3);
+	return rgb((e[0][0] * (3 - k) + e[1][0] * k + 1) / 3, (e[0][1] * (3 - k) + e[1][1] * k + 1) / 3, (e[0][2] * (3 - k) + e[1][2] * k + 1) / 3);
+}
+
+//sample (i, j, R - i - j) of face f
+rgb mc_block_sample(const mc_compressed& c, unsigned int f, unsigned int i, unsigned int j)
+{
+	unsigned int p = mc_block_position(c.R, i, j);
+	return mc_block_color(c.face(f)[p / MC_BLOCK_SAMPLES], p % MC_BLOCK_SAMPLES);
+}
+
+//compresses faces [f0, f1) of b into out, which must already be sized for b
+void encode_mc_blocks(const mc_buffer& b, mc_compressed& out, unsigned int f0, unsigned int f1)
+{
+	unsigned int R = b.R;
+	unsigned int spf = mc_face_samples(R);
+	//slot of every walk position
+	std::vector<unsigned int> walk(spf);
+	for (unsigned int i = 0; i <= R; i++) {
+		for (unsigned int j = 0; i + j <= R; j++) {
+			walk[mc_block_position(R, i, j)] = mc_grid_slot(R, i, j, R - i - j);
+		}
+	}
+	parallel_for(f0, f1, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		const rgb* src = b.face(f);
+		mc_block* dst = out.blocks.data() + size_t(f) * out.blocks_per_face;
+		for (unsigned int k = 0; k < out.blocks_per_face; k++)
+		{
+			block_samples s;
+			unsigned int p0 = k * MC_BLOCK_SAMPLES;
+			s.n = std::min(unsigned(MC_BLOCK_SAMPLES), spf - p0);
+			for (unsigned int m = 0; m < MC_BLOCK_SAMPLES; m++)
+			{
+				const rgb& c = src[walk[p0 + (m < s.n ? m : 0)]];
+				s.r[m] = c.c[0];
+				s.g[m] = c.c[1];
+				s.b[m] = c.c[2];
+			}
+			dst[k] = encode_block(s);
+		}
+	});
+}
+
+//compresses every face of b
+void encode_mc_blocks(const mc_buffer& b, mc_compressed& out)
+{
+	out.R = b.R;
+	out.face_count = b.face_count;
+	out.blocks_per_face = (mc_face_samples(b.R) + MC_BLOCK_SAMPLES - 1) / MC_BLOCK_SAMPLES;
+	out.blocks.resize(size_t(out.face_count) * out.blocks_per_face);
+	encode_mc_blocks(b, out, 0, b.face_count);
+}
+
+//expands c back to the per face layout
+void decode_mc_blocks(const mc_compressed& c, mc_buffer& out)
+{
+	out.resize(c.R, c.face_count);
+	parallel_for(0, c.face_count, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		rgb* dst = out.face(f);
+		for (unsigned int i = 0; i <= c.R; i++) {
+			for (unsigned int j = 0; i + j <= c.R; j++) {
+				dst[mc_grid_slot(c.R, i, j, c.R - i - j)] = mc_block_sample(c, f, i, j);
+			}
+		}
+	});
+	out.mark_all_dirty();
+}
+
+/* Compressed mesh colors on the gpu, one rg32ui texel per block */
+class mc_block_gpu {
+public:
+	~mc_block_gpu()
+	{
+		if (texture) glDeleteTextures(1, &texture);
+		if (buffer) glDeleteBuffers(1, &buffer);
+	}
+
+	void upload(const mc_compressed& c)
+	{
+		if (buffer == 0) {
+			GLCall(glGenBuffers(1, &buffer));
+			GLCall(glGenTextures(1, &texture));
+		}
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, buffer));
+		GLCall(glBufferData(GL_TEXTURE_BUFFER, c.blocks.size() * sizeof(mc_block), c.blocks.data(), GL_DYNAMIC_DRAW));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+		GLCall(glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, buffer));
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+		R = c.R;
+		blocks_per_face = c.blocks_per_face;
+	}
+
+	//uniforms of the mesh_colors_block shader
+	void set_uniforms(const Shader& s) const
+	{
+		s.setInt("mc_R", int(R));
+		s.setInt("mc_blocks_per_face", int(blocks_per_face));
+	}
+
+	void bind(unsigned int unit)
+	{
+		GLCall(glActiveTexture(GL_TEXTURE0 + unit));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+	}
+
+private:
+	GLuint buffer = 0;
+	GLuint texture = 0;
+	unsigned int R = 0;
+	unsigned int blocks_per_face = 0;
+};
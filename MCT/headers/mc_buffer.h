@@ -0,0 +1,251 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include "definitions.h"
+
+/* Per-face mesh colors layout.
+   Every face stores its own (R+1)(R+2)/2 samples contiguously, in the order
+   v0, v1, v2 | edge v0->v1 | edge v1->v2 | edge v2->v0 | interior rows.
+   A sample is addressed by its grid coordinates (i, j, k), i + j + k = R, which are the
+   weights of v0, v1 and v2 scaled by R, so sample position = (i*v0 + j*v1 + k*v2) / R.
+   Interior samples are sorted by i then j, the same order rface::f_index uses. */
+
+unsigned int mc_face_samples(unsigned int R)
+{
+	return (R + 1) * (R + 2) / 2;
+}
+
+unsigned int mc_edge_samples(unsigned int R)
+{
+	return R > 0 ? R - 1 : 0;
+}
+
+unsigned int mc_interior_samples(unsigned int R)
+{
+	return R > 2 ? ((R - 1) * (R - 2)) / 2 : 0;
+}
+
+//slot of grid coordinates (i, j, k) inside a face patch
+unsigned int mc_grid_slot(unsigned int R, unsigned int i, unsigned int j, unsigned int k)
+{
+	unsigned int e = mc_edge_samples(R);
+	if (i == R) return 0;
+	if (j == R) return 1;
+	if (k == R) return 2;
+	if (k == 0) return 3 + (j - 1);
+	if (i == 0) return 3 + e + (k - 1);
+	if (j == 0) return 3 + 2 * e + (i - 1);
+	//interior row i starts after rows 1 .. i-1, row r holds R-1-r samples
+	unsigned int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+	return 3 + 3 * e + row + (j - 1);
+}
+
+//grid coordinates of a face patch slot
+glm::uvec3 mc_slot_grid(unsigned int R, unsigned int slot)
+{
+	unsigned int e = mc_edge_samples(R);
+	if (slot < 3) {
+		glm::uvec3 g(0);
+		g[slot] = R;
+		return g;
+	}
+	slot -= 3;
+	if (slot < e) return glm::uvec3(R - 1 - slot, slot + 1, 0);
+	slot -= e;
+	if (slot < e) return glm::uvec3(0, R - 1 - slot, slot + 1);
+	slot -= e;
+	if (slot < e) return glm::uvec3(slot + 1, 0, R - 1 - slot);
+	slot -= e;
+	unsigned int i = 1;
+	while (slot >= R - 1 - i) {
+		slot -= R - 1 - i;
+		i++;
+	}
+	unsigned int j = slot + 1;
+	return glm::uvec3(i, j, R - i - j);
+}
+
+//barycentric weights of a face patch slot, computed like mesh_colors2::fill_colors_alt does
+glm::vec3 mc_slot_bary(unsigned int R, unsigned int slot)
+{
+	glm::uvec3 g = mc_slot_grid(R, slot);
+	double _R = R;
+	return glm::vec3((double)g.x / _R, (double)g.y / _R, 1.0 - ((double)g.x + (double)g.y) / _R);
+}
+
+//surface point and shading normal of a sample, normals are interpolated from the vertices
+void sample_surface(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, unsigned int f, const glm::vec3& w, glm::vec3& p, glm::vec3& n)
+{
+	const vertex& a = verts[inds[3 * f + 0]];
+	const vertex& b = verts[inds[3 * f + 1]];
+	const vertex& c = verts[inds[3 * f + 2]];
+	p = a.pos * w.x + b.pos * w.y + c.pos * w.z;
+	n = a.normal * w.x + b.normal * w.y + c.normal * w.z;
+	float len = glm::length(n);
+	if (len > 1e-8f) {
+		n /= len;
+	}
+	else {
+		n = glm::cross(b.pos - a.pos, c.pos - a.pos);
+		len = glm::length(n);
+		n = len > 0.0f ? n / len : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+}
+
+//texel index used by mesh_colors2 for a uv coordinate, clamped to the image
+unsigned int mc_texel(const glm::vec2& uv, unsigned int wid, unsigned int hei)
+{
+	int x = ilerp(0, wid, uv.x);
+	int y = ilerp(0, hei, uv.y);
+	x = std::min(std::max(x, 0), int(wid) - 1);
+	y = std::min(std::max(y, 0), int(hei) - 1);
+	return (x * hei) + y;
+}
+
+//half open range of samples [begin, end)
+struct sample_range {
+	size_t begin;
+	size_t end;
+};
+
+/* Ranges of samples edited since the last upload.
+   Not thread safe, parallel edits should mark their faces once they are done. */
+struct dirty_ranges {
+	std::vector<sample_range> ranges;
+
+	void add(size_t begin, size_t end)
+	{
+		if (begin >= end) {
+			return;
+		}
+		//strokes usually touch neighbouring faces one after the other
+		if (!ranges.empty() && ranges.back().end == begin) {
+			ranges.back().end = end;
+			return;
+		}
+		ranges.push_back({ begin, end });
+	}
+
+	bool empty() const { return ranges.empty(); }
+	void clear() { ranges.clear(); }
+
+	//sorted, merged ranges, gaps up to gap samples are uploaded rather than split; clears the list
+	std::vector<sample_range> take(size_t gap = 0)
+	{
+		std::vector<sample_range> out;
+		std::sort(ranges.begin(), ranges.end(), [](const sample_range& x, const sample_range& y) { return x.begin < y.begin; });
+		for (const auto& r : ranges)
+		{
+			if (!out.empty() && r.begin <= out.back().end + gap) {
+				out.back().end = std::max(out.back().end, r.end);
+			}
+			else {
+				out.push_back(r);
+			}
+		}
+		ranges.clear();
+		return out;
+	}
+};
+
+/* Mesh colors stored face by face in the layout above */
+struct mc_buffer {
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	std::vector<rgb> colors;
+	//samples changed since the last upload
+	dirty_ranges dirty;
+
+	void resize(unsigned int _R, unsigned int faces)
+	{
+		R = _R;
+		face_count = faces;
+		colors.resize(size_t(faces) * mc_face_samples(R));
+	}
+
+	size_t face_offset(unsigned int f) const { return size_t(f) * mc_face_samples(R); }
+	rgb* face(unsigned int f) { return colors.data() + face_offset(f); }
+	const rgb* face(unsigned int f) const { return colors.data() + face_offset(f); }
+
+	void set(unsigned int f, unsigned int slot, const rgb& c)
+	{
+		size_t i = face_offset(f) + slot;
+		colors[i] = c;
+		dirty.add(i, i + 1);
+	}
+
+	//marks faces [f0, f1) as edited, for writes done through face()
+	void mark_dirty(unsigned int f0, unsigned int f1)
+	{
+		dirty.add(face_offset(f0), face_offset(f1));
+	}
+
+	void mark_all_dirty()
+	{
+		dirty.clear();
+		dirty.add(0, colors.size());
+	}
+};
+
+//color at barycentric weights w of a face patch of resolution R, linear between the three nearest samples
+glm::vec3 mc_eval_patch(const rgb* src, unsigned int patch_r, glm::vec3 w)
+{
+	auto at = [&](int i, int j) {
+		const rgb& c = src[mc_grid_slot(patch_r, i, j, patch_r - i - j)];
+		return glm::vec3(c.c[0], c.c[1], c.c[2]);
+	};
+	if (patch_r == 0) {
+		return at(0, 0);
+	}
+	w = glm::max(w, glm::vec3(0.0f));
+	float sum = w.x + w.y + w.z;
+	w = sum > 0.0f ? w / sum : glm::vec3(1.0f, 0.0f, 0.0f);
+	int R = int(patch_r);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = std::min(int(x), R - 1);
+	int j = std::min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	//cells pointing up use (i, j), (i+1, j), (i, j+1), cells pointing down (i+1, j+1), (i, j+1), (i+1, j)
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = std::min(fx, 1.0f);
+		fy = std::min(fy, 1.0f - fx);
+		return at(i, j) * (1.0f - fx - fy) + at(i + 1, j) * fx + at(i, j + 1) * fy;
+	}
+	return at(i + 1, j + 1) * (fx + fy - 1.0f) + at(i, j + 1) * (1.0f - fx) + at(i + 1, j) * (1.0f - fy);
+}
+
+//color at barycentric weights w of face f
+glm::vec3 mc_eval(const mc_buffer& b, unsigned int f, const glm::vec3& w)
+{
+	return mc_eval_patch(b.face(f), b.R, w);
+}
+
+//texel read by mesh_colors2 for a given patch slot of one of its faces
+unsigned int mc_face_texel(const rface& f, unsigned int slot)
+{
+	glm::uvec3 g = mc_slot_grid(f.R, slot);
+	if (slot < 3) return f.v_index[slot];
+	if (g.x == 0) return f.e_index[0][g.y - 1];
+	if (g.y == 0) return f.e_index[1][g.x - 1];
+	if (g.z == 0) return f.e_index[2][g.x - 1];
+	return f.f_index[slot - 3 - 3 * mc_edge_samples(f.R)];
+}
+
+//gathers the colors mesh_colors2 sampled into the per face layout
+void build_mc_buffer(const mesh_colors2& m, mc_buffer& out)
+{
+	unsigned int R = m.faces.empty() ? 0 : m.faces[0].R;
+	out.resize(R, (unsigned int)m.faces.size());
+	unsigned int spf = mc_face_samples(R);
+	for (unsigned int f = 0; f < out.face_count; f++)
+	{
+		rgb* dst = out.face(f);
+		for (unsigned int s = 0; s < spf; s++) {
+			dst[s] = m.image[mc_face_texel(m.faces[f], s)];
+		}
+	}
+}
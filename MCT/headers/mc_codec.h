@@ -0,0 +1,511 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_compact.h"
+#include "topology.h"
+#include "mc_stream.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+/* Predictive, entropy coded mesh colors files.
+   Samples are coded as residuals against a prediction from samples decoded before them,
+   in three passes over the welded mesh of mesh_topology:
+     vertices   the previous vertex,
+     edges      the line from the sample before to the far end of the edge,
+     faces      the corners and edges of the face from the compact pass, a seam where the
+                face disagrees with them costs one flag; interiors from their decoded
+                neighbours with the median edge predictor of LOCO-I.
+   The green residual is coded as is, red and blue minus it. Residual bytes go through an
+   adaptive binary range coder (the one of LZMA) as 8 bit trees, one per channel, kind of
+   sample and local activity.
+   Every pass is cut in chunks of cfg.chunk items coded independently, so the chunks of a
+   pass are encoded and decoded on all workers. The decoder needs the same topology, built
+   from the mesh the colors ship with.
+   File: mc_file_header (count0 R, count1 faces), vertex, edge and chunk counts, the byte
+   size of every chunk, then the chunks. */
+
+//coded colors: count0 resolution R, count1 faces
+const char mc_coded_magic[4] = { 'M', 'C', 'R', 'C' };
+//largest R of a coded file, mesh_colors2 goes up to r = 8, bounds what a damaged header can allocate
+const unsigned int mc_codec_max_R = 255;
+
+struct mc_codec_config {
+	//vertices, edges or faces per chunk
+	unsigned int chunk = 8192;
+};
+
+namespace {
+	const uint32_t rc_top = 1u << 24;
+	const unsigned int rc_prob_bits = 11;
+	const unsigned int rc_move_bits = 5;
+
+	struct range_encoder {
+		std::vector<unsigned char>& out;
+		uint64_t low = 0;
+		uint32_t range = 0xFFFFFFFFu;
+		unsigned char cache = 0;
+		uint64_t cache_size = 1;
+
+		range_encoder(std::vector<unsigned char>& o) : out(o) {}
+
+		void shift_low()
+		{
+			if (uint32_t(low) < 0xFF000000u || (low >> 32) != 0) {
+				unsigned char carry = (unsigned char)(low >> 32);
+				unsigned char c = cache;
+				do {
+					out.push_back((unsigned char)(c + carry));
+					c = 0xFF;
+				} while (--cache_size != 0);
+				cache = (unsigned char)(low >> 24);
+			}
+			cache_size++;
+			low = (low & 0x00FFFFFFu) << 8;
+		}
+
+		void bit(uint16_t& p, unsigned int b)
+		{
+			uint32_t bound = (range >> rc_prob_bits) * p;
+			if (b == 0) {
+				range = bound;
+				p += ((1u << rc_prob_bits) - p) >> rc_move_bits;
+			}
+			else {
+				low += bound;
+				range -= bound;
+				p -= p >> rc_move_bits;
+			}
+			while (range < rc_top) {
+				range <<= 8;
+				shift_low();
+			}
+		}
+
+		void flush()
+		{
+			for (int i = 0; i < 5; i++) {
+				shift_low();
+			}
+		}
+	};
+
+	struct range_decoder {
+		const unsigned char* in;
+		const unsigned char* end;
+		uint32_t range = 0xFFFFFFFFu;
+		uint32_t code = 0;
+
+		range_decoder(const unsigned char* data, size_t size) : in(data), end(data + size)
+		{
+			for (int i = 0; i < 5; i++) {
+				code = (code << 8) | next();
+			}
+		}
+
+		//past the end reads zeros, a damaged chunk decodes to garbage but never reads outside it
+		unsigned int next() { return in < end ? *in++ : 0; }
+
+		unsigned int bit(uint16_t& p)
+		{
+			uint32_t bound = (range >> rc_prob_bits) * p;
+			unsigned int b;
+			if (code < bound) {
+				range = bound;
+				p += ((1u << rc_prob_bits) - p) >> rc_move_bits;
+				b = 0;
+			}
+			else {
+				code -= bound;
+				range -= bound;
+				p -= p >> rc_move_bits;
+				b = 1;
+			}
+			while (range < rc_top) {
+				range <<= 8;
+				code = (code << 8) | next();
+			}
+			return b;
+		}
+	};
+
+	//contexts: vertex, 4 edge activities, seam, 4 interior activities
+	enum codec_context {
+		CTX_VERTEX = 0,
+		CTX_EDGE = 1,
+		CTX_SEAM = 5,
+		CTX_INTERIOR = 6,
+		CTX_COUNT = 10
+	};
+
+	//one bit tree per context and channel, plus the seam flag
+	struct codec_model {
+		uint16_t tree[CTX_COUNT][3][256];
+		uint16_t seam;
+
+		codec_model()
+		{
+			for (auto& c : tree) for (auto& t : c) for (uint16_t& p : t) p = 1u << (rc_prob_bits - 1);
+			seam = 1u << (rc_prob_bits - 1);
+		}
+	};
+
+	//signed residual byte folded to 0, -1, 1, -2 ..
+	unsigned int fold(int r)
+	{
+		int s = int(int8_t(uint8_t(r)));
+		return s >= 0 ? unsigned(2 * s) : unsigned(-2 * s - 1);
+	}
+
+	int unfold(unsigned int z)
+	{
+		return (z & 1) ? -int((z + 1) >> 1) : int(z >> 1);
+	}
+
+	void encode_byte(range_encoder& e, uint16_t* tree, unsigned int s)
+	{
+		unsigned int m = 1;
+		for (int b = 7; b >= 0; b--)
+		{
+			unsigned int bit = (s >> b) & 1;
+			e.bit(tree[m], bit);
+			m = (m << 1) | bit;
+		}
+	}
+
+	unsigned int decode_byte(range_decoder& d, uint16_t* tree)
+	{
+		unsigned int m = 1;
+		for (int b = 0; b < 8; b++) {
+			m = (m << 1) | d.bit(tree[m]);
+		}
+		return m - 256;
+	}
+
+	//green first, red and blue as their difference to the green residual
+	void encode_color(range_encoder& e, codec_model& m, unsigned int ctx, const rgb& x, const rgb& pred)
+	{
+		int g = int(x.c[1]) - int(pred.c[1]);
+		encode_byte(e, m.tree[ctx][1], fold(g));
+		encode_byte(e, m.tree[ctx][0], fold(int(x.c[0]) - int(pred.c[0]) - g));
+		encode_byte(e, m.tree[ctx][2], fold(int(x.c[2]) - int(pred.c[2]) - g));
+	}
+
+	rgb decode_color(range_decoder& d, codec_model& m, unsigned int ctx, const rgb& pred)
+	{
+		int g = unfold(decode_byte(d, m.tree[ctx][1]));
+		int r = unfold(decode_byte(d, m.tree[ctx][0])) + g;
+		int b = unfold(decode_byte(d, m.tree[ctx][2])) + g;
+		rgb x;
+		x.c[0] = (unsigned char)(int(pred.c[0]) + r);
+		x.c[1] = (unsigned char)(int(pred.c[1]) + g);
+		x.c[2] = (unsigned char)(int(pred.c[2]) + b);
+		return x;
+	}
+
+	//bucket of how much colors change around a sample
+	unsigned int activity(const rgb& a, const rgb& b)
+	{
+		int d = 0;
+		for (int k = 0; k < 3; k++) {
+			d += std::abs(int(a.c[k]) - int(b.c[k]));
+		}
+		return d <= 2 ? 0 : (d <= 8 ? 1 : (d <= 32 ? 2 : 3));
+	}
+
+	//sample after prev on the line to end, steps samples away
+	rgb line_predict(const rgb& prev, const rgb& end, unsigned int steps)
+	{
+		rgb p;
+		for (int k = 0; k < 3; k++)
+		{
+			int d = int(end.c[k]) - int(prev.c[k]);
+			p.c[k] = (unsigned char)(int(prev.c[k]) + (d >= 0 ? (d + int(steps) / 2) : (d - int(steps) / 2)) / int(steps));
+		}
+		return p;
+	}
+
+	//median edge detector: a and b the neighbours along the two lattice axes, c the one across
+	rgb med_predict(const rgb& a, const rgb& b, const rgb& c)
+	{
+		rgb p;
+		for (int k = 0; k < 3; k++)
+		{
+			int x = a.c[k], y = b.c[k], z = c.c[k];
+			int v = z >= std::max(x, y) ? std::min(x, y) : (z <= std::min(x, y) ? std::max(x, y) : x + y - z);
+			p.c[k] = (unsigned char)v;
+		}
+		return p;
+	}
+
+	const rgb codec_gray = rgb(128, 128, 128);
+
+	//samples m = 1 .. R-1 of an edge between colors c0 and c1, coded or decoded in place
+	template<typename F>
+	void code_edge(unsigned int R, const rgb& c0, const rgb& c1, F code)
+	{
+		rgb prev = c0;
+		for (unsigned int m = 1; m < R; m++)
+		{
+			rgb pred = line_predict(prev, c1, R - m + 1);
+			prev = code(m, CTX_EDGE + activity(prev, c1), pred);
+		}
+	}
+
+	//interior of a patch in decode order, rows k = 1 .. R-2 then j, from the three decoded neighbours
+	template<typename F>
+	void code_interior(unsigned int R, rgb* patch, F code)
+	{
+		for (unsigned int k = 1; k + 1 < R; k++) {
+			for (unsigned int j = 1; j + k < R; j++)
+			{
+				unsigned int i = R - j - k;
+				const rgb& a = patch[mc_grid_slot(R, i + 1, j - 1, k)];
+				const rgb& b = patch[mc_grid_slot(R, i + 1, j, k - 1)];
+				const rgb& c = patch[mc_grid_slot(R, i + 2, j - 1, k - 1)];
+				unsigned int ctx = CTX_INTERIOR + std::max(activity(a, c), activity(b, c));
+				unsigned int s = mc_grid_slot(R, i, j, k);
+				patch[s] = code(ctx, med_predict(a, b, c), patch[s]);
+			}
+		}
+	}
+
+	//the compact slot of every boundary sample of face f, corners then edges
+	void boundary_slots(const mc_compact& c, unsigned int f, std::vector<size_t>& slots)
+	{
+		unsigned int n = 3 + 3 * mc_edge_samples(c.R);
+		slots.resize(n);
+		for (unsigned int s = 0; s < n; s++)
+		{
+			glm::uvec3 g = mc_slot_grid(c.R, s);
+			slots[s] = c.slot(f, g.x, g.y, g.z);
+		}
+	}
+
+	//runs fn(chunk, first, last) for every chunk of count items on all workers
+	template<typename F>
+	void for_each_chunk(size_t count, size_t chunk, F fn)
+	{
+		size_t chunks = (count + chunk - 1) / chunk;
+		parallel_blocks(0, chunks, worker_count(), [&](size_t c0, size_t c1, unsigned int) {
+			for (size_t c = c0; c < c1; c++) {
+				fn(c, c * chunk, std::min(count, (c + 1) * chunk));
+			}
+		});
+	}
+};
+
+/* codes the colors of b, faces of topo, into out as a whole file */
+bool encode_mc_colors(const mc_buffer& b, const mesh_topology& topo, const mc_codec_config& cfg, std::vector<unsigned char>& out)
+{
+	if (b.face_count != topo.face_count() || b.R == 0) {
+		std::cout << "colors do not match the mesh topology" << std::endl;
+		return false;
+	}
+	if (b.R > mc_codec_max_R) {
+		std::cout << "R " << b.R << " above the coded colors limit of " << mc_codec_max_R << std::endl;
+		return false;
+	}
+	unsigned int R = b.R;
+	unsigned int e_samples = mc_edge_samples(R);
+	size_t chunk = std::max(1u, cfg.chunk);
+	//one owner per shared sample, as the compact layout keeps them
+	mc_compact c;
+	build_mc_compact(b, topo, c);
+
+	size_t vchunks = (c.vertex_count + chunk - 1) / chunk;
+	size_t echunks = (c.edge_count + chunk - 1) / chunk;
+	size_t fchunks = (c.face_count + chunk - 1) / chunk;
+	std::vector<std::vector<unsigned char>> chunks(vchunks + echunks + fchunks);
+
+	for_each_chunk(c.vertex_count, chunk, [&](size_t n, size_t v0, size_t v1) {
+		range_encoder e(chunks[n]);
+		codec_model m;
+		rgb prev = codec_gray;
+		for (size_t v = v0; v < v1; v++)
+		{
+			encode_color(e, m, CTX_VERTEX, c.colors[v], prev);
+			prev = c.colors[v];
+		}
+		e.flush();
+	});
+	for_each_chunk(c.edge_count, chunk, [&](size_t n, size_t e0, size_t e1) {
+		range_encoder e(chunks[vchunks + n]);
+		codec_model m;
+		for (size_t ei = e0; ei < e1 && e_samples > 0; ei++)
+		{
+			unsigned int h = topo.edge_half_edge[ei];
+			const rgb* src = c.colors.data() + c.edge_slot((unsigned int)ei, 1);
+			code_edge(R, c.colors[topo.origin[h]], c.colors[topo.dest(h)], [&](unsigned int s, unsigned int ctx, const rgb& pred) {
+				encode_color(e, m, ctx, src[s - 1], pred);
+				return src[s - 1];
+			});
+		}
+		e.flush();
+	});
+	for_each_chunk(c.face_count, chunk, [&](size_t n, size_t f0, size_t f1) {
+		range_encoder e(chunks[vchunks + echunks + n]);
+		codec_model m;
+		std::vector<size_t> slots;
+		std::vector<rgb> patch(mc_face_samples(R));
+		for (size_t f = f0; f < f1; f++)
+		{
+			const rgb* src = b.face((unsigned int)f);
+			std::copy(src, src + patch.size(), patch.begin());
+			boundary_slots(c, (unsigned int)f, slots);
+			bool seam = false;
+			for (size_t s = 0; s < slots.size(); s++) {
+				seam = seam || !(patch[s] == c.colors[slots[s]]);
+			}
+			e.bit(m.seam, seam);
+			for (size_t s = 0; s < slots.size() && seam; s++) {
+				encode_color(e, m, CTX_SEAM, patch[s], c.colors[slots[s]]);
+			}
+			code_interior(R, patch.data(), [&](unsigned int ctx, const rgb& pred, const rgb& x) {
+				encode_color(e, m, ctx, x, pred);
+				return x;
+			});
+		}
+		e.flush();
+	});
+
+	mc_file_header h;
+	make_header(h, mc_coded_magic, R, c.face_count);
+	uint32_t counts[4] = { c.vertex_count, c.edge_count, (uint32_t)chunk, 0 };
+	out.resize(sizeof(h) + sizeof(counts) + chunks.size() * sizeof(uint64_t));
+	std::memcpy(out.data(), &h, sizeof(h));
+	std::memcpy(out.data() + sizeof(h), counts, sizeof(counts));
+	uint64_t* sizes = (uint64_t*)(out.data() + sizeof(h) + sizeof(counts));
+	for (size_t n = 0; n < chunks.size(); n++) {
+		sizes[n] = chunks[n].size();
+	}
+	for (const auto& ch : chunks) {
+		out.insert(out.end(), ch.begin(), ch.end());
+	}
+	return true;
+}
+
+/* decodes a file made by encode_mc_colors for the same topology */
+bool decode_mc_colors(const unsigned char* data, size_t size, const mesh_topology& topo, mc_buffer& out)
+{
+	mc_file_header h;
+	uint32_t counts[4];
+	if (size < sizeof(h) + sizeof(counts)) {
+		std::cout << "coded colors too small" << std::endl;
+		return false;
+	}
+	std::memcpy(&h, data, sizeof(h));
+	std::memcpy(counts, data + sizeof(h), sizeof(counts));
+	if (std::memcmp(h.magic, mc_coded_magic, 4) != 0 || h.version != 1) {
+		std::cout << "unexpected coded colors format" << std::endl;
+		return false;
+	}
+	if (h.count0 == 0 || h.count1 != topo.face_count() || counts[0] != topo.vertex_count() || counts[1] != topo.edge_count() || counts[2] == 0) {
+		std::cout << "coded colors were made for another mesh" << std::endl;
+		return false;
+	}
+	if (h.count0 > mc_codec_max_R) {
+		std::cout << "unexpected coded colors format" << std::endl;
+		return false;
+	}
+	unsigned int R = (unsigned int)h.count0;
+	unsigned int e_samples = mc_edge_samples(R);
+	size_t chunk = counts[2];
+	size_t vchunks = (counts[0] + chunk - 1) / chunk;
+	size_t echunks = (counts[1] + chunk - 1) / chunk;
+	size_t fchunks = (h.count1 + chunk - 1) / chunk;
+	size_t nchunks = vchunks + echunks + fchunks;
+	size_t table = sizeof(h) + sizeof(counts);
+	if (size < table + nchunks * sizeof(uint64_t)) {
+		std::cout << "truncated coded colors" << std::endl;
+		return false;
+	}
+	std::vector<size_t> offsets(nchunks + 1);
+	offsets[0] = table + nchunks * sizeof(uint64_t);
+	for (size_t n = 0; n < nchunks; n++)
+	{
+		uint64_t s;
+		std::memcpy(&s, data + table + n * sizeof(uint64_t), sizeof(s));
+		//checked before the sum so a huge size cannot wrap it
+		if (s > size - offsets[n]) {
+			std::cout << "truncated coded colors" << std::endl;
+			return false;
+		}
+		offsets[n + 1] = offsets[n] + size_t(s);
+	}
+	auto chunk_decoder = [&](size_t n) { return range_decoder(data + offsets[n], offsets[n + 1] - offsets[n]); };
+
+	//compact layout of the shared samples, then every face
+	mc_compact c;
+	layout_mc_compact(topo, R, c);
+	for_each_chunk(c.vertex_count, chunk, [&](size_t n, size_t v0, size_t v1) {
+		range_decoder d = chunk_decoder(n);
+		codec_model m;
+		rgb prev = codec_gray;
+		for (size_t v = v0; v < v1; v++) {
+			prev = c.colors[v] = decode_color(d, m, CTX_VERTEX, prev);
+		}
+	});
+	for_each_chunk(c.edge_count, chunk, [&](size_t n, size_t e0, size_t e1) {
+		range_decoder d = chunk_decoder(vchunks + n);
+		codec_model m;
+		for (size_t ei = e0; ei < e1 && e_samples > 0; ei++)
+		{
+			unsigned int h = topo.edge_half_edge[ei];
+			rgb* dst = c.colors.data() + c.edge_slot((unsigned int)ei, 1);
+			code_edge(R, c.colors[topo.origin[h]], c.colors[topo.dest(h)], [&](unsigned int s, unsigned int ctx, const rgb& pred) {
+				return dst[s - 1] = decode_color(d, m, ctx, pred);
+			});
+		}
+	});
+
+	out.resize(R, c.face_count);
+	for_each_chunk(c.face_count, chunk, [&](size_t n, size_t f0, size_t f1) {
+		range_decoder d = chunk_decoder(vchunks + echunks + n);
+		codec_model m;
+		std::vector<size_t> slots;
+		for (size_t f = f0; f < f1; f++)
+		{
+			rgb* patch = out.face((unsigned int)f);
+			boundary_slots(c, (unsigned int)f, slots);
+			bool seam = d.bit(m.seam) != 0;
+			for (size_t s = 0; s < slots.size(); s++) {
+				patch[s] = seam ? decode_color(d, m, CTX_SEAM, c.colors[slots[s]]) : c.colors[slots[s]];
+			}
+			code_interior(R, patch, [&](unsigned int ctx, const rgb& pred, const rgb&) {
+				return decode_color(d, m, ctx, pred);
+			});
+		}
+	});
+	out.mark_all_dirty();
+	return true;
+}
+
+bool save_mc_coded(const mc_buffer& b, const mesh_topology& topo, const char* path, const mc_codec_config& cfg = mc_codec_config())
+{
+	std::vector<unsigned char> bytes;
+	if (!encode_mc_colors(b, topo, cfg, bytes)) {
+		return false;
+	}
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	out.write((const char*)bytes.data(), bytes.size());
+	return bool(out);
+}
+
+bool load_mc_coded(const char* path, const mesh_topology& topo, mc_buffer& out)
+{
+	mapped_file in(path);
+	if (!in.is_open()) {
+		return false;
+	}
+	return decode_mc_colors(in.data(), in.size(), topo, out);
+}
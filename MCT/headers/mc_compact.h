@@ -0,0 +1,322 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <vector>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_upload.h"
+#include "topology.h"
+#include "parallel.h"
+
+/* Compact mesh colors.
+   Every sample is stored once: V vertex samples, then R-1 samples per edge, then the
+   (R-1)(R-2)/2 interior samples of every face, V + E(R-1) + F(R-1)(R-2)/2 colors in all,
+   where mc_buffer repeats vertex and edge samples in each face around them. Vertices and
+   edges are the welded ones of mesh_topology, an edge keeps its samples in the direction
+   of its edge_half_edge.
+   Each face has two entries in a table: its welded vertices and the offset of its interior
+   samples, then the offsets of the samples of its three edges with the high bit set when
+   the face walks the edge backwards. The mesh_colors_compact shader finds every sample from
+   there with gl_PrimitiveID and the barycentric weights.
+   collapse_mc_compact stores an edge or an interior whose samples are all the same color
+   as that one color, its offset then carries MC_CONSTANT. Flat shaded and toon assets are
+   mostly made of those. */
+
+#define MC_EDGE_REVERSED 0x80000000u
+#define MC_CONSTANT 0x40000000u
+#define MC_OFFSET_MASK 0x3FFFFFFFu
+
+struct mc_compact {
+	unsigned int R = 0;
+	unsigned int vertex_count = 0;
+	unsigned int edge_count = 0;
+	unsigned int face_count = 0;
+	std::vector<rgb> colors;
+	//face f: table[2f] = welded v0, v1, v2 and interior offset, table[2f+1] = offsets of edges 0->1, 1->2, 2->0
+	std::vector<glm::uvec4> table;
+	//set by collapse_mc_compact
+	bool collapsed = false;
+	unsigned int constant_edges = 0;
+	unsigned int constant_faces = 0;
+
+	size_t edge_base() const { return vertex_count; }
+	//sample m of welded edge e, only before collapse_mc_compact
+	size_t edge_slot(unsigned int e, unsigned int m) const { return edge_base() + size_t(e) * mc_edge_samples(R) + (m - 1); }
+
+	//index in colors of the sample of face f at grid coordinates (i, j, k)
+	size_t slot(unsigned int f, unsigned int i, unsigned int j, unsigned int k) const
+	{
+		const glm::uvec4& v = table[2 * size_t(f)];
+		if (i == R) return v.x;
+		if (j == R) return v.y;
+		if (k == R) return v.z;
+		//edge n, m steps from its first corner
+		unsigned int n, m;
+		if (k == 0) { n = 0; m = j; }
+		else if (i == 0) { n = 1; m = k; }
+		else if (j == 0) { n = 2; m = i; }
+		else {
+			if (v.w & MC_CONSTANT) {
+				return v.w & MC_OFFSET_MASK;
+			}
+			unsigned int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+			return v.w + row + (j - 1);
+		}
+		unsigned int e = table[2 * size_t(f) + 1][n];
+		if (e & MC_CONSTANT) {
+			return e & MC_OFFSET_MASK;
+		}
+		if (e & MC_EDGE_REVERSED) {
+			m = R - m;
+		}
+		return (e & MC_OFFSET_MASK) + (m - 1);
+	}
+
+	size_t bytes() const { return colors.size() * sizeof(rgb) + table.size() * sizeof(glm::uvec4); }
+};
+
+//sizes out for resolution R over the faces of topo and fills its face table, colors are left black
+void layout_mc_compact(const mesh_topology& topo, unsigned int R, mc_compact& out)
+{
+	out.R = R;
+	out.vertex_count = topo.vertex_count();
+	out.edge_count = topo.edge_count();
+	out.face_count = topo.face_count();
+	unsigned int f_samples = mc_interior_samples(R);
+	size_t face_base = out.edge_base() + size_t(out.edge_count) * mc_edge_samples(R);
+	out.colors.assign(face_base + size_t(out.face_count) * f_samples, rgb(0, 0, 0));
+	out.table.resize(2 * size_t(out.face_count));
+	out.collapsed = false;
+	out.constant_edges = out.constant_faces = 0;
+
+	parallel_for(0, out.face_count, [&](size_t f) {
+		glm::uvec4& v = out.table[2 * f];
+		glm::uvec4& e = out.table[2 * f + 1];
+		for (unsigned int k = 0; k < 3; k++)
+		{
+			unsigned int h = unsigned(3 * f + k);
+			v[k] = topo.origin[h];
+			bool reversed = topo.origin[topo.edge_half_edge[topo.edge[h]]] != topo.origin[h];
+			e[k] = unsigned(out.edge_slot(topo.edge[h], 1)) | (reversed ? MC_EDGE_REVERSED : 0u);
+		}
+		v.w = unsigned(face_base + f * f_samples);
+		e.w = 0;
+	});
+}
+
+/* packs the patches of b, faces of topo, into out. Shared samples are taken from the face
+   of the half-edge topology keeps for them, faces of b that disagree on a shared sample
+   (a painted seam) end up with the color of that face. */
+void build_mc_compact(const mc_buffer& b, const mesh_topology& topo, mc_compact& out)
+{
+	layout_mc_compact(topo, b.R, out);
+	unsigned int e_samples = mc_edge_samples(b.R);
+	unsigned int f_samples = mc_interior_samples(b.R);
+
+	parallel_for(0, out.face_count, [&](size_t f) {
+		const rgb* src = b.face((unsigned int)f) + 3 + 3 * e_samples;
+		std::copy(src, src + f_samples, out.colors.begin() + out.table[2 * f].w);
+	});
+	parallel_for(0, out.vertex_count, [&](size_t v) {
+		unsigned int h = topo.vertex_half_edge[v];
+		if (h != NO_HALF_EDGE) {
+			out.colors[v] = b.face(h / 3)[h % 3];
+		}
+	});
+	parallel_for(0, out.edge_count, [&](size_t e) {
+		unsigned int h = topo.edge_half_edge[e];
+		const rgb* src = b.face(h / 3) + 3 + (h % 3) * e_samples;
+		std::copy(src, src + e_samples, out.colors.begin() + out.edge_slot((unsigned int)e, 1));
+	});
+}
+
+namespace {
+	//true if the n colors differ by at most tolerance in every channel, mid is then the middle of their range
+	bool uniform_colors(const rgb* c, unsigned int n, unsigned int tolerance, rgb& mid)
+	{
+		int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+		for (unsigned int s = 0; s < n; s++) {
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = std::min(lo[k], int(c[s].c[k]));
+				hi[k] = std::max(hi[k], int(c[s].c[k]));
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			if (unsigned(hi[k] - lo[k]) > tolerance) {
+				return false;
+			}
+			mid.c[k] = (unsigned char)((lo[k] + hi[k] + 1) / 2);
+		}
+		return true;
+	}
+};
+
+/* Stores every edge and interior of c whose samples differ by at most tolerance per channel
+   as a single color, the middle of their range, so no sample moves by more than about
+   tolerance / 2. Vertices stay as they are. */
+void collapse_mc_compact(mc_compact& c, unsigned int tolerance = 0)
+{
+	if (c.collapsed) {
+		return;
+	}
+	unsigned int e_samples = mc_edge_samples(c.R);
+	unsigned int f_samples = mc_interior_samples(c.R);
+	//constant edges and interiors, then where each one goes
+	std::vector<unsigned char> edge_flat(c.edge_count, 0), face_flat(c.face_count, 0);
+	std::vector<rgb> edge_color(c.edge_count), face_color(c.face_count);
+	if (e_samples > 1) {
+		parallel_for(0, c.edge_count, [&](size_t e) {
+			edge_flat[e] = uniform_colors(c.colors.data() + c.edge_slot((unsigned int)e, 1), e_samples, tolerance, edge_color[e]);
+		});
+	}
+	if (f_samples > 1) {
+		parallel_for(0, c.face_count, [&](size_t f) {
+			face_flat[f] = uniform_colors(c.colors.data() + c.table[2 * f].w, f_samples, tolerance, face_color[f]);
+		});
+	}
+	std::vector<unsigned int> edge_offset(c.edge_count), face_offset(c.face_count);
+	unsigned int constant_edges = 0, constant_faces = 0;
+	for (unsigned int e = 0; e < c.edge_count; e++)
+	{
+		edge_offset[e] = edge_flat[e] ? 1 : e_samples;
+		constant_edges += edge_flat[e];
+	}
+	for (unsigned int f = 0; f < c.face_count; f++)
+	{
+		face_offset[f] = face_flat[f] ? 1 : f_samples;
+		constant_faces += face_flat[f];
+	}
+	size_t edge_total = prefix_sum(edge_offset);
+	size_t face_total = prefix_sum(face_offset);
+
+	std::vector<rgb> colors(c.vertex_count + edge_total + face_total);
+	std::copy(c.colors.begin(), c.colors.begin() + c.vertex_count, colors.begin());
+	size_t new_face_base = c.vertex_count + edge_total;
+	parallel_for(0, c.edge_count, [&](size_t e) {
+		rgb* dst = colors.data() + c.vertex_count + edge_offset[e];
+		if (edge_flat[e]) {
+			*dst = edge_color[e];
+		}
+		else {
+			const rgb* src = c.colors.data() + c.edge_slot((unsigned int)e, 1);
+			std::copy(src, src + e_samples, dst);
+		}
+	});
+	parallel_for(0, c.face_count, [&](size_t f) {
+		rgb* dst = colors.data() + new_face_base + face_offset[f];
+		glm::uvec4& v = c.table[2 * f];
+		glm::uvec4& t = c.table[2 * f + 1];
+		if (face_flat[f]) {
+			*dst = face_color[f];
+		}
+		else {
+			const rgb* src = c.colors.data() + v.w;
+			std::copy(src, src + f_samples, dst);
+		}
+		v.w = unsigned(new_face_base + face_offset[f]) | (face_flat[f] ? MC_CONSTANT : 0u);
+		for (int k = 0; k < 3 && e_samples > 0; k++)
+		{
+			size_t e = ((t[k] & MC_OFFSET_MASK) - c.edge_base()) / e_samples;
+			t[k] = unsigned(c.vertex_count + edge_offset[e]) | (t[k] & MC_EDGE_REVERSED) | (edge_flat[e] ? MC_CONSTANT : 0u);
+		}
+	});
+	c.colors.swap(colors);
+	c.collapsed = true;
+	c.constant_edges = constant_edges;
+	c.constant_faces = constant_faces;
+}
+
+//expands c back to the per face layout
+void unpack_mc_compact(const mc_compact& c, mc_buffer& out)
+{
+	out.resize(c.R, c.face_count);
+	unsigned int spf = mc_face_samples(c.R);
+	parallel_for(0, c.face_count, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		rgb* dst = out.face(f);
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			glm::uvec3 g = mc_slot_grid(c.R, s);
+			dst[s] = c.colors[c.slot(f, g.x, g.y, g.z)];
+		}
+	});
+	out.mark_all_dirty();
+}
+
+//color at barycentric weights w of face f, same interpolation as mc_eval_patch
+glm::vec3 mc_eval(const mc_compact& c, unsigned int f, glm::vec3 w)
+{
+	auto at = [&](int i, int j) {
+		const rgb& s = c.colors[c.slot(f, i, j, c.R - i - j)];
+		return glm::vec3(s.c[0], s.c[1], s.c[2]);
+	};
+	if (c.R == 0) {
+		return at(0, 0);
+	}
+	w = glm::max(w, glm::vec3(0.0f));
+	float sum = w.x + w.y + w.z;
+	w = sum > 0.0f ? w / sum : glm::vec3(1.0f, 0.0f, 0.0f);
+	int R = int(c.R);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = std::min(int(x), R - 1);
+	int j = std::min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = std::min(fx, 1.0f);
+		fy = std::min(fy, 1.0f - fx);
+		return at(i, j) * (1.0f - fx - fy) + at(i + 1, j) * fx + at(i, j + 1) * fy;
+	}
+	return at(i + 1, j + 1) * (fx + fy - 1.0f) + at(i, j + 1) * (1.0f - fx) + at(i + 1, j) * (1.0f - fy);
+}
+
+/* Compact mesh colors on the gpu: colors as rgba8 texels, the face table as rgba32ui texels,
+   both texture buffers */
+class mc_compact_gpu {
+public:
+	~mc_compact_gpu()
+	{
+		if (table_texture) glDeleteTextures(1, &table_texture);
+		if (table_buffer) glDeleteBuffers(1, &table_buffer);
+	}
+
+	void upload(const mc_compact& c)
+	{
+		colors.upload(c.colors.data(), c.colors.size());
+		if (table_buffer == 0) {
+			GLCall(glGenBuffers(1, &table_buffer));
+			GLCall(glGenTextures(1, &table_texture));
+		}
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, table_buffer));
+		GLCall(glBufferData(GL_TEXTURE_BUFFER, c.table.size() * sizeof(glm::uvec4), c.table.data(), GL_STATIC_DRAW));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, table_texture));
+		GLCall(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, table_buffer));
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+		R = c.R;
+	}
+
+	//uniforms of the mesh_colors_compact shader
+	void set_uniforms(const Shader& s) const
+	{
+		s.setInt("mc_R", int(R));
+	}
+
+	//colors on unit, the face table on unit + 1
+	void bind(unsigned int unit)
+	{
+		colors.bind(unit);
+		GLCall(glActiveTexture(GL_TEXTURE0 + unit + 1));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, table_texture));
+	}
+
+private:
+	mc_gpu_buffer colors;
+	GLuint table_buffer = 0;
+	GLuint table_texture = 0;
+	unsigned int R = 0;
+};
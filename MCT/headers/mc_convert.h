@@ -0,0 +1,202 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MC_CONVERT_SSE 1
+#include <emmintrin.h>
+#endif
+
+/* Resolution change of baked mesh colors, no source texture needed.
+   Every target sample is a weighted sum of at most three source samples of the same face:
+   vertices are copied, edge samples interpolate between the two nearest samples of their
+   edge only, so both faces of an edge still agree, and interior samples interpolate in
+   the source lattice cell around them. The taps are the same for every face, they are
+   computed once and applied to eight faces at a time, one face per 16 bit sse lane. */
+
+namespace {
+	//weights are 8.8 fixed point and always sum to 256
+	struct convert_tap {
+		uint16_t slot[3];
+		uint16_t w[3];
+	};
+
+	//source slot of point m along edge k -> k+1 of a patch of resolution R
+	unsigned int edge_point_slot(unsigned int R, unsigned int k, unsigned int m)
+	{
+		if (m == 0) return k;
+		if (m == R) return (k + 1) % 3;
+		return 3 + k * mc_edge_samples(R) + (m - 1);
+	}
+
+	void convert_taps(unsigned int R1, unsigned int R2, std::vector<convert_tap>& taps)
+	{
+		unsigned int spf = mc_face_samples(R2);
+		unsigned int e2 = mc_edge_samples(R2);
+		taps.assign(spf, convert_tap());
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			convert_tap& t = taps[s];
+			if (s < 3) {
+				t = { { uint16_t(s), uint16_t(s), uint16_t(s) }, { 256, 0, 0 } };
+			}
+			else if (s < 3 + 3 * e2) {
+				//exact position along the edge is p / R2 source steps; the rounding only depends
+				//on the distance to the nearer point so the reversed edge gets the same weights
+				unsigned int k = (s - 3) / e2;
+				unsigned int p = ((s - 3) % e2 + 1) * R1;
+				unsigned int m = p / R2, rem = p % R2;
+				uint16_t w_far;
+				if (2 * rem <= R2) {
+					w_far = uint16_t((rem * 256 + R2 / 2) / R2);
+					t.w[1] = w_far;
+					t.w[0] = uint16_t(256 - w_far);
+				}
+				else {
+					w_far = uint16_t(((R2 - rem) * 256 + R2 / 2) / R2);
+					t.w[0] = w_far;
+					t.w[1] = uint16_t(256 - w_far);
+				}
+				t.w[2] = 0;
+				t.slot[0] = uint16_t(edge_point_slot(R1, k, m));
+				t.slot[1] = uint16_t(edge_point_slot(R1, k, std::min(m + 1, R1)));
+				t.slot[2] = t.slot[0];
+			}
+			else {
+				//the source lattice cell around the sample, as in mc_eval_patch
+				glm::vec3 g = glm::vec3(mc_slot_grid(R2, s)) * (float(R1) / float(R2));
+				int i = std::min(int(g.x), int(R1) - 1);
+				int j = std::min(int(g.y), int(R1) - 1 - i);
+				float fx = g.x - i, fy = g.y - j;
+				int ci[3], cj[3];
+				float w[3];
+				if (fx + fy <= 1.0f || i + j + 2 > int(R1)) {
+					fx = std::min(fx, 1.0f);
+					fy = std::min(fy, 1.0f - fx);
+					ci[0] = i; cj[0] = j; w[0] = 1.0f - fx - fy;
+					ci[1] = i + 1; cj[1] = j; w[1] = fx;
+					ci[2] = i; cj[2] = j + 1; w[2] = fy;
+				}
+				else {
+					ci[0] = i + 1; cj[0] = j + 1; w[0] = fx + fy - 1.0f;
+					ci[1] = i; cj[1] = j + 1; w[1] = 1.0f - fx;
+					ci[2] = i + 1; cj[2] = j; w[2] = 1.0f - fy;
+				}
+				int sum = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					t.slot[c] = uint16_t(mc_grid_slot(R1, ci[c], cj[c], R1 - ci[c] - cj[c]));
+					t.w[c] = uint16_t(w[c] * 256.0f + 0.5f);
+					sum += t.w[c];
+				}
+				t.w[0] = uint16_t(t.w[0] + 256 - sum);
+			}
+		}
+	}
+};
+
+//resamples src to resolution R into out, out must not be src and is left untouched on failure
+bool convert_mc_resolution(const mc_buffer& src, unsigned int R, mc_buffer& out)
+{
+	if (src.R == 0 || R == 0 || mc_face_samples(src.R) > 0xFFFF) {
+		std::cout << "mesh colors resolution conversion needs 0 < R < 361" << std::endl;
+		return false;
+	}
+	out.resize(R, src.face_count);
+	if (src.R == R) {
+		out.colors = src.colors;
+		out.mark_all_dirty();
+		return true;
+	}
+	std::vector<convert_tap> taps;
+	convert_taps(src.R, R, taps);
+	unsigned int spf1 = mc_face_samples(src.R);
+	unsigned int spf2 = mc_face_samples(R);
+	unsigned int faces = src.face_count;
+
+	auto scalar_face = [&](unsigned int f) {
+		const unsigned char* in = (const unsigned char*)src.face(f);
+		unsigned char* o = (unsigned char*)out.face(f);
+		for (unsigned int s = 0; s < spf2; s++) {
+			const convert_tap& t = taps[s];
+			for (int c = 0; c < 3; c++) {
+				o[3 * s + c] = (unsigned char)((in[3 * t.slot[0] + c] * t.w[0] + in[3 * t.slot[1] + c] * t.w[1] +
+					in[3 * t.slot[2] + c] * t.w[2] + 128) >> 8);
+			}
+		}
+	};
+
+#ifdef MC_CONVERT_SSE
+	unsigned int blocks = faces / 8;
+	parallel_blocks(0, blocks, worker_count() * 4, [&](size_t b0, size_t b1, unsigned int) {
+		//eight faces transposed so each channel of a sample is one register, lane = face
+		std::vector<uint16_t> in(size_t(spf1) * 3 * 8), o(size_t(spf2) * 3 * 8);
+		for (size_t b = b0; b < b1; b++)
+		{
+			unsigned int f0 = (unsigned int)(b * 8);
+			const unsigned char* p[8];
+			for (int l = 0; l < 8; l++) {
+				p[l] = (const unsigned char*)src.face(f0 + l);
+			}
+			for (unsigned int t = 0; t < spf1 * 3; t++) {
+				for (int l = 0; l < 8; l++) {
+					in[t * 8 + l] = p[l][t];
+				}
+			}
+			__m128i half = _mm_set1_epi16(128);
+			for (unsigned int s = 0; s < spf2; s++)
+			{
+				const convert_tap& t = taps[s];
+				__m128i w0 = _mm_set1_epi16(short(t.w[0]));
+				__m128i w1 = _mm_set1_epi16(short(t.w[1]));
+				__m128i w2 = _mm_set1_epi16(short(t.w[2]));
+				for (int c = 0; c < 3; c++)
+				{
+					//at most 255 * 256 + 128, fits unsigned 16 bits
+					__m128i a = _mm_loadu_si128((const __m128i*)&in[(3 * t.slot[0] + c) * 8]);
+					__m128i b = _mm_loadu_si128((const __m128i*)&in[(3 * t.slot[1] + c) * 8]);
+					__m128i d = _mm_loadu_si128((const __m128i*)&in[(3 * t.slot[2] + c) * 8]);
+					__m128i acc = _mm_add_epi16(_mm_mullo_epi16(a, w0), half);
+					acc = _mm_add_epi16(acc, _mm_mullo_epi16(b, w1));
+					acc = _mm_add_epi16(acc, _mm_mullo_epi16(d, w2));
+					_mm_storeu_si128((__m128i*)&o[(3 * s + c) * 8], _mm_srli_epi16(acc, 8));
+				}
+			}
+			unsigned char* d[8];
+			for (int l = 0; l < 8; l++) {
+				d[l] = (unsigned char*)out.face(f0 + l);
+			}
+			for (unsigned int t = 0; t < spf2 * 3; t++) {
+				for (int l = 0; l < 8; l++) {
+					d[l][t] = (unsigned char)o[t * 8 + l];
+				}
+			}
+		}
+	});
+	for (unsigned int f = blocks * 8; f < faces; f++) {
+		scalar_face(f);
+	}
+#else
+	parallel_for(0, faces, [&](size_t f) { scalar_face((unsigned int)f); });
+#endif
+	out.mark_all_dirty();
+	return true;
+}
+
+//changes the resolution of b to R, b is unchanged on failure
+bool convert_mc_resolution(mc_buffer& b, unsigned int R)
+{
+	mc_buffer tmp;
+	if (!convert_mc_resolution(b, R, tmp)) {
+		return false;
+	}
+	b.R = tmp.R;
+	b.colors.swap(tmp.colors);
+	b.mark_all_dirty();
+	return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <atomic>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "bvh.h"
+#include "parallel.h"
+
+/* High to low poly baking into mesh colors.
+   Every sample of the low poly mesh looks for the high poly surface along its normal, both
+   outwards and inwards, and keeps the nearest hit. From there it stores either the high poly
+   normal or the high poly mesh colors, so detail sculpted on the dense mesh survives
+   decimation without a uv unwrap. Each sample is independent, the result does not depend
+   on the thread count. */
+
+enum detail_bake_mode {
+	//object space normal of the high poly mesh, stored as n * 0.5 + 0.5
+	DETAIL_NORMAL,
+	//mesh colors of the high poly mesh
+	DETAIL_COLOR
+};
+
+struct detail_bake_config {
+	detail_bake_mode mode = DETAIL_NORMAL;
+	unsigned int R = 7;
+	//search distance along the normal, 0 uses 5% of the low poly bounding box diagonal
+	float max_distance = 0.0f;
+};
+
+//object space normal to rgb and back
+rgb encode_normal(const glm::vec3& n)
+{
+	glm::vec3 e = glm::clamp(n * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f;
+	return rgb(int(e.x), int(e.y), int(e.z));
+}
+
+glm::vec3 decode_normal(const rgb& c)
+{
+	return glm::normalize(glm::vec3(c.c[0], c.c[1], c.c[2]) / 255.0f * 2.0f - 1.0f);
+}
+
+/* Bakes the high poly mesh (high_tree built over high_verts / high_inds) onto the low poly
+   faces. high_colors is only read in DETAIL_COLOR mode and must cover the high poly faces.
+   Samples that find no surface keep their own normal, or black in color mode.
+   Returns the number of samples that missed. */
+size_t bake_high_to_low(const bvh& high_tree, const std::vector<vertex>& high_verts, const std::vector<unsigned int>& high_inds,
+	const mc_buffer* high_colors, const std::vector<vertex>& low_verts, const std::vector<unsigned int>& low_inds,
+	mc_buffer& out, const detail_bake_config& cfg)
+{
+	unsigned int faces = (unsigned int)(low_inds.size() / 3);
+	out.resize(cfg.R, faces);
+	if (faces == 0) {
+		return 0;
+	}
+	if (cfg.mode == DETAIL_COLOR && (high_colors == nullptr || high_colors->face_count * 3 < high_inds.size())) {
+		std::cout << "color bake needs mesh colors for every high poly face" << std::endl;
+		return out.colors.size();
+	}
+
+	float range = cfg.max_distance;
+	if (range <= 0.0f) {
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (const auto& v : low_verts) {
+			lo = glm::min(lo, v.pos);
+			hi = glm::max(hi, v.pos);
+		}
+		range = 0.05f * glm::length(hi - lo);
+	}
+
+	unsigned int spf = mc_face_samples(cfg.R);
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = glm::vec3(mc_slot_grid(cfg.R, s)) / float(cfg.R > 0 ? cfg.R : 1);
+	}
+
+	std::atomic<size_t> misses(0);
+	parallel_for(0, faces, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		rgb* dst = out.face(f);
+		size_t missed = 0;
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			glm::vec3 p, n;
+			sample_surface(low_verts, low_inds, f, bary[s], p, n);
+
+			//outwards then inwards, the nearer surface wins; a small negative tmin keeps
+			//surfaces lying exactly on the low poly one
+			ray r;
+			r.o = p;
+			r.d = n;
+			r.tmin = -1e-4f * range;
+			r.tmax = range;
+			ray_hit hit;
+			high_tree.intersect(r, hit);
+			ray_hit back;
+			r.d = -n;
+			if (high_tree.intersect(r, back) && back.t < hit.t) {
+				hit = back;
+			}
+			if (hit.face == BVH_NO_FACE) {
+				dst[s] = cfg.mode == DETAIL_NORMAL ? encode_normal(n) : rgb(0, 0, 0);
+				missed++;
+				continue;
+			}
+
+			glm::vec3 w(1.0f - hit.u - hit.v, hit.u, hit.v);
+			if (cfg.mode == DETAIL_NORMAL) {
+				glm::vec3 hp, hn;
+				sample_surface(high_verts, high_inds, hit.face, w, hp, hn);
+				dst[s] = encode_normal(hn);
+			}
+			else {
+				glm::vec3 c = mc_eval(*high_colors, hit.face, w) + 0.5f;
+				dst[s] = rgb(int(c.x), int(c.y), int(c.z));
+			}
+		}
+		misses += missed;
+	});
+	out.mark_all_dirty();
+	return misses.load();
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "parallel.h"
+
+/* Area filtered resampling of a texture into mesh colors.
+   fill_colors_alt reads one texel per sample, which aliases when R is low for the texture
+   and reads the same texel over and over when R is high. Here every sample averages the
+   texels under its footprint in uv space, the box around the midpoints to its six lattice
+   neighbours, read from a summed area table in constant time whatever the footprint size. */
+
+/* Summed area table of an rgb image indexed as x*hei + y, like mesh_colors2::image.
+   Sums are kept modulo 2^32, box sums stay exact as long as a box holds fewer than
+   2^32 / 255 texels, which also halves the memory of 64 bit sums. */
+struct summed_area_table {
+	unsigned int wid = 0;
+	unsigned int hei = 0;
+	//(wid + 1) x (hei + 1) entries of 3 channels, row and column 0 are zero
+	std::vector<uint32_t> sums;
+
+	void build(const rgb* image, unsigned int w, unsigned int h)
+	{
+		wid = w;
+		hei = h;
+		size_t stride = size_t(hei) + 1;
+		sums.assign((size_t(wid) + 1) * stride * 3, 0);
+
+		//prefix along y, every column on its own
+		parallel_for(0, wid, [&](size_t x) {
+			uint32_t* dst = sums.data() + (x + 1) * stride * 3;
+			const rgb* src = image + x * hei;
+			uint32_t acc[3] = { 0, 0, 0 };
+			for (unsigned int y = 0; y < hei; y++) {
+				for (int k = 0; k < 3; k++) {
+					acc[k] += src[y].c[k];
+					dst[(y + 1) * 3 + k] = acc[k];
+				}
+			}
+		});
+		//prefix along x, split in bands of y so each pass walks contiguous memory
+		parallel_blocks(0, stride * 3, worker_count(), [&](size_t b0, size_t b1, size_t) {
+			for (size_t x = 1; x <= wid; x++)
+			{
+				uint32_t* cur = sums.data() + x * stride * 3;
+				const uint32_t* prev = cur - stride * 3;
+				for (size_t i = b0; i < b1; i++) {
+					cur[i] += prev[i];
+				}
+			}
+		});
+	}
+
+	//mean color of texels [x0, x1] x [y0, y1], bounds inclusive and inside the image
+	glm::vec3 box_mean(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) const
+	{
+		size_t stride = size_t(hei) + 1;
+		const uint32_t* a = sums.data() + (size_t(x0) * stride + y0) * 3;
+		const uint32_t* b = sums.data() + (size_t(x1 + 1) * stride + y0) * 3;
+		const uint32_t* c = sums.data() + (size_t(x0) * stride + y1 + 1) * 3;
+		const uint32_t* d = sums.data() + (size_t(x1 + 1) * stride + y1 + 1) * 3;
+		float area = float(x1 - x0 + 1) * float(y1 - y0 + 1);
+		glm::vec3 out;
+		for (int k = 0; k < 3; k++) {
+			out[k] = float(uint32_t(d[k] - b[k] - c[k] + a[k])) / area;
+		}
+		return out;
+	}
+};
+
+//mean of the texels covered by the box c +- half, in texel units, clamped to the image
+glm::vec3 footprint_mean(const summed_area_table& sat, const glm::vec2& c, const glm::vec2& half)
+{
+	glm::ivec2 lo = glm::ivec2(glm::floor(c - half));
+	glm::ivec2 hi = glm::ivec2(glm::floor(c + half));
+	lo = glm::clamp(lo, glm::ivec2(0), glm::ivec2(sat.wid - 1, sat.hei - 1));
+	hi = glm::clamp(hi, lo, glm::ivec2(sat.wid - 1, sat.hei - 1));
+	return sat.box_mean(lo.x, lo.y, hi.x, hi.y);
+}
+
+//averages the texture over every sample footprint of faces inds into out at resolution R
+void build_mc_buffer_filtered(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds,
+	const summed_area_table& sat, unsigned int R, mc_buffer& out)
+{
+	unsigned int faces = (unsigned int)(inds.size() / 3);
+	out.resize(R, faces);
+	if (faces == 0 || sat.wid == 0 || sat.hei == 0) {
+		return;
+	}
+	unsigned int spf = mc_face_samples(R);
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = mc_slot_bary(R, s);
+	}
+	glm::vec2 size(sat.wid, sat.hei);
+	float inv_r = 1.0f / float(R > 0 ? R : 1);
+
+	parallel_for(0, faces, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		glm::vec2 t0 = verts[inds[3 * f + 0]].uv * size;
+		glm::vec2 t1 = verts[inds[3 * f + 1]].uv * size;
+		glm::vec2 t2 = verts[inds[3 * f + 2]].uv * size;
+		//lattice steps in texels, the footprint reaches halfway to each neighbour
+		glm::vec2 d1 = (t1 - t0) * inv_r;
+		glm::vec2 d2 = (t2 - t0) * inv_r;
+		glm::vec2 half = 0.5f * glm::max(glm::abs(d1), glm::max(glm::abs(d2), glm::abs(d2 - d1)));
+
+		rgb* dst = out.face(f);
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			glm::vec2 c = t0 * bary[s].x + t1 * bary[s].y + t2 * bary[s].z;
+			glm::vec3 m = footprint_mean(sat, c, half) + 0.5f;
+			dst[s] = rgb(int(m.x), int(m.y), int(m.z));
+		}
+	});
+	out.mark_all_dirty();
+}
+
+//area filtered counterpart of build_mc_buffer, at the resolution mesh_colors2 was built with
+void build_mc_buffer_filtered(const mesh_colors2& m, mc_buffer& out)
+{
+	summed_area_table sat;
+	sat.build(m.image.data(), m.wid, m.hei);
+	build_mc_buffer_filtered(m.vertices, m.indices, sat, m.faces.empty() ? 0 : m.faces[0].R, out);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "mc_buffer.h"
+
+/* Undo history for mesh colors edits.
+   The colors of an mc_buffer are seen as fixed size chunks. The first write to a chunk
+   during a step copies it, so a step only holds the chunks it changed. Undo and redo swap
+   those copies with the live colors, their cost depends on the size of the edit and not on
+   the size of the model. Old steps are dropped once the history goes over its budget. */
+class mc_history {
+public:
+	mc_history(mc_buffer& b, size_t budget_bytes = size_t(256) << 20, size_t samples_per_chunk = 4096)
+		: colors(b), budget(budget_bytes), chunk_samples(std::max<size_t>(1, samples_per_chunk)) {}
+
+	//opens a step, every write until end_step() is undone together
+	void begin_step()
+	{
+		if (recording) {
+			end_step();
+		}
+		recording = true;
+		current = step();
+		stamp++;
+		size_t chunks = (colors.colors.size() + chunk_samples - 1) / chunk_samples;
+		if (saved_stamp.size() != chunks) {
+			saved_stamp.assign(chunks, 0);
+		}
+	}
+
+	//must be called before samples [begin, end) are written, writes outside a step are not recorded
+	void before_write(size_t begin, size_t end)
+	{
+		if (!recording || begin >= end) {
+			return;
+		}
+		end = std::min(end, colors.colors.size());
+		for (size_t c = begin / chunk_samples; c * chunk_samples < end; c++)
+		{
+			if (saved_stamp[c] == stamp) {
+				continue;
+			}
+			saved_stamp[c] = stamp;
+			size_t c0 = c * chunk_samples;
+			size_t c1 = std::min(c0 + chunk_samples, colors.colors.size());
+			current.chunks.push_back({ c, std::vector<rgb>(colors.colors.begin() + c0, colors.colors.begin() + c1) });
+			current.bytes += (c1 - c0) * sizeof(rgb);
+		}
+	}
+
+	void before_write_faces(unsigned int f0, unsigned int f1)
+	{
+		before_write(colors.face_offset(f0), colors.face_offset(f1));
+	}
+
+	void end_step()
+	{
+		if (!recording) {
+			return;
+		}
+		recording = false;
+		if (current.chunks.empty()) {
+			return;
+		}
+		//a new edit drops whatever could have been redone
+		while (steps.size() > cursor) {
+			bytes -= steps.back().bytes;
+			steps.pop_back();
+		}
+		bytes += current.bytes;
+		steps.push_back(std::move(current));
+		cursor = steps.size();
+
+		//evict the oldest steps, the newest one is always kept
+		while (bytes > budget && steps.size() > 1) {
+			bytes -= steps.front().bytes;
+			steps.pop_front();
+			cursor--;
+		}
+	}
+
+	bool undo()
+	{
+		end_step();
+		if (cursor == 0) {
+			return false;
+		}
+		swap_step(steps[--cursor]);
+		return true;
+	}
+
+	bool redo()
+	{
+		end_step();
+		if (cursor == steps.size()) {
+			return false;
+		}
+		swap_step(steps[cursor++]);
+		return true;
+	}
+
+	void clear()
+	{
+		steps.clear();
+		cursor = 0;
+		bytes = 0;
+		recording = false;
+	}
+
+	bool can_undo() const { return cursor > 0; }
+	bool can_redo() const { return cursor < steps.size(); }
+	size_t memory() const { return bytes; }
+
+private:
+	struct saved_chunk {
+		size_t chunk;
+		std::vector<rgb> data;
+	};
+
+	struct step {
+		std::vector<saved_chunk> chunks;
+		size_t bytes = 0;
+	};
+
+	//exchanges saved and live chunks, after the swap the step holds the state to go back to
+	void swap_step(step& s)
+	{
+		for (auto& c : s.chunks)
+		{
+			size_t c0 = c.chunk * chunk_samples;
+			std::swap_ranges(c.data.begin(), c.data.end(), colors.colors.begin() + c0);
+			colors.dirty.add(c0, c0 + c.data.size());
+		}
+	}
+
+	mc_buffer& colors;
+	size_t budget;
+	size_t chunk_samples;
+
+	std::deque<step> steps;
+	//steps before cursor can be undone, from cursor on they can be redone
+	size_t cursor = 0;
+	size_t bytes = 0;
+
+	step current;
+	bool recording = false;
+	//chunks already copied in the open step carry its stamp
+	std::vector<unsigned int> saved_stamp;
+	unsigned int stamp = 0;
+};
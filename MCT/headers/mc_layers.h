@@ -0,0 +1,379 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <GLM/gtc/packing.hpp>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_filter.h"
+#include "parallel.h"
+
+/* Layered mesh colors: several attributes per sample, interleaved.
+   Each layer holds one shading input in its own format, albedo and specular as rgb8 or
+   rgba8, the normal as two half floats, the height as one byte. All layers of a sample sit
+   side by side in one record of at most 16 bytes, the gpu copy is a texture buffer of
+   32 bit words where a record is one texel, so the shader gets every input of a sample with
+   one texelFetch.
+   Layers are baked in a single pass over the faces: the footprint of each sample in uv and
+   its shading frame are found once, every layer box filters its own texture over that
+   footprint (as build_mc_buffer_filtered does). Normal maps are tangent space, they are
+   turned to object space with the frame of the face and stored octahedron encoded. */
+
+enum mc_layer_format {
+	MC_LAYER_RGB8,
+	MC_LAYER_RGBA8,
+	//two half floats
+	MC_LAYER_RG16F,
+	MC_LAYER_R8
+};
+
+//what a layer feeds in the shader
+enum mc_layer_role {
+	MC_ROLE_ALBEDO,
+	MC_ROLE_SPECULAR,
+	MC_ROLE_NORMAL,
+	MC_ROLE_HEIGHT
+};
+
+unsigned int mc_layer_bytes(mc_layer_format f)
+{
+	switch (f)
+	{
+	case MC_LAYER_RGB8: return 3;
+	case MC_LAYER_RGBA8: return 4;
+	case MC_LAYER_RG16F: return 4;
+	default: return 1;
+	}
+}
+
+//largest record, one rgba32ui texel
+const unsigned int mc_layer_max_stride = 16;
+
+struct mc_layer {
+	mc_layer_role role;
+	mc_layer_format format;
+	//byte offset inside a sample record
+	unsigned int offset;
+};
+
+struct mc_layered {
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	std::vector<mc_layer> layers;
+	//bytes per sample record, a multiple of 4
+	unsigned int stride = 0;
+	//records in the mc_buffer order, sample s of face f at record f * mc_face_samples(R) + s
+	std::vector<unsigned char> data;
+
+	size_t samples() const { return size_t(face_count) * mc_face_samples(R); }
+	unsigned char* record(size_t s) { return data.data() + s * stride; }
+	const unsigned char* record(size_t s) const { return data.data() + s * stride; }
+	size_t bytes() const { return data.size(); }
+
+	//index of the layer with this role, -1 when there is none
+	int find(mc_layer_role role) const
+	{
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l].role == role) return int(l);
+		}
+		return -1;
+	}
+};
+
+/* A texture a layer is baked from */
+struct mc_layer_source {
+	mc_layer_role role = MC_ROLE_ALBEDO;
+	mc_layer_format format = MC_LAYER_RGB8;
+	summed_area_table color;
+	//alpha of rgba8 layers in the first channel, empty otherwise
+	summed_area_table alpha;
+};
+
+namespace {
+	//unit vector to the octahedron unfolded on [-1, 1]^2
+	glm::vec2 octahedron_encode(glm::vec3 n)
+	{
+		n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f) {
+			e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return e;
+	}
+
+	glm::vec3 octahedron_decode(glm::vec2 e)
+	{
+		glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+		if (n.z < 0.0f) {
+			glm::vec2 f = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+			n.x = f.x;
+			n.y = f.y;
+		}
+		return glm::normalize(n);
+	}
+
+	bool valid_layer(mc_layer_role role, mc_layer_format format)
+	{
+		switch (role)
+		{
+		case MC_ROLE_NORMAL: return format == MC_LAYER_RG16F;
+		case MC_ROLE_HEIGHT: return format == MC_LAYER_R8;
+		default: return format == MC_LAYER_RGB8 || format == MC_LAYER_RGBA8 || format == MC_LAYER_R8;
+		}
+	}
+
+	unsigned char unit_byte(float v)
+	{
+		return (unsigned char)std::min(255.0f, std::max(0.0f, v + 0.5f));
+	}
+};
+
+/* loads the texture of a layer, false if it cannot be read or the format does not fit the role */
+bool load_mc_layer_source(const char* path, mc_layer_role role, mc_layer_format format, mc_layer_source& out)
+{
+	if (!valid_layer(role, format)) {
+		std::cout << "layer format does not fit its role: " << path << std::endl;
+		return false;
+	}
+	int w, h, c;
+	unsigned char* img = SOIL_load_image(path, &w, &h, &c, SOIL_LOAD_AUTO);
+	if (img == NULL) {
+		std::cout << "failed to load layer texture " << path << std::endl;
+		return false;
+	}
+	//same pixel order as mesh_colors2::build_imarray, gray images repeat their channel
+	size_t n = size_t(w) * h;
+	std::vector<rgb> pixels(n), alpha;
+	if (format == MC_LAYER_RGBA8) {
+		alpha.assign(n, rgb(255, 255, 255));
+	}
+	parallel_for(0, n, [&](size_t i) {
+		const unsigned char* p = img + i * c;
+		pixels[i] = c >= 3 ? rgb(p[0], p[1], p[2]) : rgb(p[0], p[0], p[0]);
+		if (!alpha.empty() && (c == 2 || c == 4)) {
+			alpha[i] = rgb(p[c - 1], 0, 0);
+		}
+	});
+	SOIL_free_image_data(img);
+
+	out.role = role;
+	out.format = format;
+	out.color.build(pixels.data(), w, h);
+	if (!alpha.empty()) {
+		out.alpha.build(alpha.data(), w, h);
+	}
+	else {
+		out.alpha = summed_area_table();
+	}
+	return true;
+}
+
+/* bakes every source into its layer of out at resolution R, layers in the order of sources */
+bool bake_mc_layers(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds,
+	const std::vector<mc_layer_source>& sources, unsigned int R, mc_layered& out)
+{
+	out.R = R;
+	out.face_count = (unsigned int)(inds.size() / 3);
+	out.layers.clear();
+	unsigned int offset = 0;
+	for (const mc_layer_source& src : sources)
+	{
+		if (src.color.wid == 0 || src.color.hei == 0) {
+			std::cout << "layer source without a texture" << std::endl;
+			return false;
+		}
+		out.layers.push_back({ src.role, src.format, offset });
+		offset += mc_layer_bytes(src.format);
+	}
+	out.stride = (offset + 3) & ~3u;
+	if (out.stride == 0 || out.stride > mc_layer_max_stride) {
+		std::cout << "layers take " << offset << " bytes a sample, at most " << mc_layer_max_stride << " fit a fetch" << std::endl;
+		return false;
+	}
+	out.data.assign(out.samples() * out.stride, 0);
+	bool normals = out.find(MC_ROLE_NORMAL) >= 0;
+
+	unsigned int spf = mc_face_samples(R);
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = mc_slot_bary(R, s);
+	}
+	float inv_r = 1.0f / float(R > 0 ? R : 1);
+
+	parallel_blocks(0, out.face_count, worker_count(), [&](size_t f0, size_t f1, unsigned int) {
+		std::vector<glm::vec2> center(spf);
+		std::vector<glm::vec3> normal(normals ? spf : 0);
+		for (size_t fi = f0; fi < f1; fi++)
+		{
+			unsigned int f = (unsigned int)fi;
+			const vertex& a = verts[inds[3 * f + 0]];
+			const vertex& b = verts[inds[3 * f + 1]];
+			const vertex& c = verts[inds[3 * f + 2]];
+			//footprint in uv, scaled to texels per layer below
+			glm::vec2 d1 = (b.uv - a.uv) * inv_r;
+			glm::vec2 d2 = (c.uv - a.uv) * inv_r;
+			glm::vec2 half = 0.5f * glm::max(glm::abs(d1), glm::max(glm::abs(d2), glm::abs(d2 - d1)));
+			for (unsigned int s = 0; s < spf; s++) {
+				center[s] = a.uv * bary[s].x + b.uv * bary[s].y + c.uv * bary[s].z;
+			}
+
+			//tangent of the face from its uv gradients, the bitangent is rebuilt per sample with this handedness
+			glm::vec3 tangent(1.0f, 0.0f, 0.0f);
+			float handed = 1.0f;
+			if (normals)
+			{
+				glm::vec3 e1 = b.pos - a.pos, e2 = c.pos - a.pos;
+				glm::vec2 t1 = b.uv - a.uv, t2 = c.uv - a.uv;
+				float det = t1.x * t2.y - t2.x * t1.y;
+				if (std::abs(det) > 1e-12f) {
+					tangent = (e1 * t2.y - e2 * t1.y) / det;
+					glm::vec3 bitangent = (e2 * t1.x - e1 * t2.x) / det;
+					handed = glm::dot(glm::cross(tangent, bitangent), glm::cross(e1, e2)) < 0.0f ? -1.0f : 1.0f;
+				}
+				glm::vec3 p;
+				for (unsigned int s = 0; s < spf; s++) {
+					sample_surface(verts, inds, f, bary[s], p, normal[s]);
+				}
+			}
+
+			for (size_t l = 0; l < sources.size(); l++)
+			{
+				const mc_layer_source& src = sources[l];
+				glm::vec2 size(src.color.wid, src.color.hei);
+				unsigned int o = out.layers[l].offset;
+				unsigned char* dst = out.record(size_t(f) * spf) + o;
+				for (unsigned int s = 0; s < spf; s++, dst += out.stride)
+				{
+					glm::vec3 m = footprint_mean(src.color, center[s] * size, half * size);
+					switch (src.format)
+					{
+					case MC_LAYER_RGBA8:
+						dst[3] = src.alpha.wid > 0 ? unit_byte(footprint_mean(src.alpha, center[s] * size, half * size).x) : 255;
+						//and the rgb below
+					case MC_LAYER_RGB8:
+						dst[0] = unit_byte(m.x);
+						dst[1] = unit_byte(m.y);
+						dst[2] = unit_byte(m.z);
+						break;
+					case MC_LAYER_R8:
+						dst[0] = unit_byte(m.x);
+						break;
+					case MC_LAYER_RG16F:
+					{
+						//tangent space to object space, the frame made orthogonal to the shading normal
+						glm::vec3 n = normal[s];
+						glm::vec3 t = tangent - n * glm::dot(n, tangent);
+						float tt = glm::dot(t, t);
+						t = tt > 1e-24f ? t / std::sqrt(tt) : glm::vec3(0.0f);
+						glm::vec3 bt = glm::cross(n, t) * handed;
+						glm::vec3 ts = m / 127.5f - 1.0f;
+						glm::vec3 os = t * ts.x + bt * ts.y + n * ts.z;
+						float oo = glm::dot(os, os);
+						os = oo > 1e-12f ? os / std::sqrt(oo) : n;
+						uint32_t packed = glm::packHalf2x16(octahedron_encode(os));
+						std::memcpy(dst, &packed, sizeof(packed));
+						break;
+					}
+					}
+				}
+			}
+		}
+	});
+	return true;
+}
+
+//value of layer l at sample s: colors in 0..1 with alpha in w, normals as a unit vector, heights in x
+glm::vec4 mc_layer_value(const mc_layered& m, unsigned int l, size_t s)
+{
+	const unsigned char* p = m.record(s) + m.layers[l].offset;
+	switch (m.layers[l].format)
+	{
+	case MC_LAYER_RGB8: return glm::vec4(p[0], p[1], p[2], 255.0f) / 255.0f;
+	case MC_LAYER_RGBA8: return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+	case MC_LAYER_R8: return glm::vec4(p[0] / 255.0f, 0.0f, 0.0f, 1.0f);
+	default:
+	{
+		uint32_t packed;
+		std::memcpy(&packed, p, sizeof(packed));
+		return glm::vec4(octahedron_decode(glm::unpackHalf2x16(packed)), 0.0f);
+	}
+	}
+}
+
+//copies layer l to an mc_buffer for the single layer tools, normals as 0.5 + 0.5 n
+void extract_mc_layer(const mc_layered& m, unsigned int l, mc_buffer& out)
+{
+	out.resize(m.R, m.face_count);
+	bool normal = m.layers[l].format == MC_LAYER_RG16F;
+	bool single = m.layers[l].format == MC_LAYER_R8;
+	parallel_for(0, m.samples(), [&](size_t s) {
+		glm::vec4 v = mc_layer_value(m, l, s);
+		if (normal) v = 0.5f + 0.5f * v;
+		if (single) v = glm::vec4(v.x);
+		out.colors[s] = rgb(unit_byte(v.x * 255.0f), unit_byte(v.y * 255.0f), unit_byte(v.z * 255.0f));
+	});
+	out.mark_all_dirty();
+}
+
+/* Layered mesh colors on the gpu, a record per texel of a 32 bit unsigned texture buffer */
+class mc_layered_gpu {
+public:
+	~mc_layered_gpu()
+	{
+		if (texture) glDeleteTextures(1, &texture);
+		if (buffer) glDeleteBuffers(1, &buffer);
+	}
+
+	void upload(const mc_layered& m)
+	{
+		static const GLenum formats[4] = { GL_R32UI, GL_RG32UI, GL_RGB32UI, GL_RGBA32UI };
+		if (buffer == 0) {
+			GLCall(glGenBuffers(1, &buffer));
+			GLCall(glGenTextures(1, &texture));
+		}
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, buffer));
+		GLCall(glBufferData(GL_TEXTURE_BUFFER, m.data.size(), m.data.data(), GL_STATIC_DRAW));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+		GLCall(glTexBuffer(GL_TEXTURE_BUFFER, formats[m.stride / 4 - 1], buffer));
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+		R = m.R;
+		for (int r = 0; r < 4; r++)
+		{
+			int l = m.find(mc_layer_role(r));
+			offsets[r] = l >= 0 ? int(m.layers[l].offset) : -1;
+			single[r] = l >= 0 && m.layers[l].format == MC_LAYER_R8;
+		}
+	}
+
+	//uniforms of the mesh_colors_layers shader, light and eye in object space
+	void set_uniforms(const Shader& s, const glm::vec3& light_dir, const glm::vec3& eye) const
+	{
+		s.setInt("mc_R", int(R));
+		s.setInt("mc_albedo_offset", offsets[MC_ROLE_ALBEDO]);
+		s.setInt("mc_specular_offset", offsets[MC_ROLE_SPECULAR]);
+		s.setInt("mc_normal_offset", offsets[MC_ROLE_NORMAL]);
+		s.setInt("mc_height_offset", offsets[MC_ROLE_HEIGHT]);
+		s.setBool("mc_albedo_gray", single[MC_ROLE_ALBEDO]);
+		s.setBool("mc_specular_gray", single[MC_ROLE_SPECULAR]);
+		s.setVec3("mc_light_dir", light_dir);
+		s.setVec3("mc_eye", eye);
+	}
+
+	void bind(unsigned int unit)
+	{
+		GLCall(glActiveTexture(GL_TEXTURE0 + unit));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+	}
+
+private:
+	GLuint buffer = 0;
+	GLuint texture = 0;
+	unsigned int R = 0;
+	//per role, -1 when absent
+	int offsets[4] = { -1, -1, -1, -1 };
+	bool single[4] = { false, false, false, false };
+};
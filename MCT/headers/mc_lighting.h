@@ -0,0 +1,156 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cmath>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "bvh.h"
+#include "thread_pool.h"
+
+/* Ambient occlusion and direct light baked into mesh colors.
+   Every sample gets albedo * (ambient * ao + sum of visible directional lights), so at
+   runtime the shaded color is a single mesh colors fetch. Occlusion rays are traced four
+   at a time through the bvh and their directions only depend on the sample index, so the
+   result is the same whatever the thread count. */
+
+struct directional_light {
+	//direction towards the light
+	glm::vec3 dir;
+	glm::vec3 color;
+};
+
+struct light_bake_config {
+	//occlusion rays per sample
+	unsigned int ao_rays = 32;
+	//occlusion range, 0 uses a tenth of the bounding box diagonal
+	float ao_distance = 0.0f;
+	glm::vec3 ambient = glm::vec3(0.3f);
+	std::vector<directional_light> lights = { { glm::normalize(glm::vec3(0.0f, 1.0f, 1.0f)), glm::vec3(0.7f) } };
+	bool shadows = true;
+};
+
+namespace {
+	unsigned int bake_hash(unsigned int x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352dU;
+		x ^= x >> 15;
+		x *= 0x846ca68bU;
+		x ^= x >> 16;
+		return x;
+	}
+
+	float radical_inverse(unsigned int bits)
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return float(bits) * 2.3283064365386963e-10f;
+	}
+
+	//orthonormal basis around n
+	void tangent_frame(const glm::vec3& n, glm::vec3& t, glm::vec3& b)
+	{
+		float s = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (s + n.z);
+		float c = n.x * n.y * a;
+		t = glm::vec3(1.0f + s * n.x * n.x * a, s * c, -s * n.x);
+		b = glm::vec3(c, s + n.y * n.y * a, -n.y);
+	}
+};
+
+//bakes lighting of albedo (white when it has no colors) into out, out may be albedo itself;
+//false when albedo does not cover the faces of inds
+bool bake_lighting(const bvh& tree, const std::vector<vertex>& verts, const std::vector<unsigned int>& inds,
+	const mc_buffer& albedo, mc_buffer& out, const light_bake_config& cfg, thread_pool& pool = default_pool())
+{
+	unsigned int faces = (unsigned int)(inds.size() / 3);
+	if ((!albedo.colors.empty() || &out == &albedo) && albedo.face_count != faces) {
+		std::cout << "albedo colors have " << albedo.face_count << " faces, the mesh has " << faces << std::endl;
+		return false;
+	}
+	unsigned int R = albedo.colors.empty() ? out.R : albedo.R;
+	if (&out != &albedo) {
+		out.resize(R, faces);
+	}
+	if (faces == 0 || tree.nodes.empty()) {
+		return true;
+	}
+	unsigned int spf = mc_face_samples(R);
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = glm::vec3(mc_slot_grid(R, s)) / float(R > 0 ? R : 1);
+	}
+
+	float diag = glm::length(tree.nodes[0].bmax - tree.nodes[0].bmin);
+	float range = cfg.ao_distance > 0.0f ? cfg.ao_distance : 0.1f * diag;
+	float bias = 1e-4f * diag;
+	unsigned int ao_rays = (cfg.ao_rays + 3) / 4 * 4;
+	const bool has_albedo = !albedo.colors.empty();
+
+	pool.parallel_for(0, faces, 16, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		const rgb* src = has_albedo ? albedo.face(f) : nullptr;
+		rgb* dst = out.face(f);
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			glm::vec3 p, n, t, b;
+			sample_surface(verts, inds, f, bary[s], p, n);
+			tangent_frame(n, t, b);
+			glm::vec3 o = p + n * bias;
+
+			//cosine weighted hammersley set, rotated per sample
+			unsigned int seed = bake_hash(unsigned(out.face_offset(f) + s));
+			float ju = (seed & 0xFFFF) / 65536.0f;
+			float jv = (seed >> 16) / 65536.0f;
+			unsigned int open = ao_rays;
+			for (unsigned int k = 0; k < ao_rays; k += 4)
+			{
+				ray packet[4];
+				for (unsigned int l = 0; l < 4; l++)
+				{
+					float u = std::fmod(float(k + l) / ao_rays + ju, 1.0f);
+					float v = std::fmod(radical_inverse(k + l) + jv, 1.0f);
+					float r = std::sqrt(u);
+					float phi = 6.28318530718f * v;
+					packet[l].o = o;
+					packet[l].d = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - u));
+					packet[l].tmax = range;
+				}
+				int blocked = tree.occluded4(packet);
+				for (unsigned int l = 0; l < 4; l++) {
+					open -= (blocked >> l) & 1;
+				}
+			}
+			float ao = ao_rays > 0 ? float(open) / ao_rays : 1.0f;
+
+			glm::vec3 light = cfg.ambient * ao;
+			for (const auto& L : cfg.lights)
+			{
+				float ndl = glm::dot(n, L.dir);
+				if (ndl <= 0.0f) {
+					continue;
+				}
+				if (cfg.shadows) {
+					ray shadow;
+					shadow.o = o;
+					shadow.d = L.dir;
+					if (tree.occluded(shadow)) {
+						continue;
+					}
+				}
+				light += L.color * ndl;
+			}
+
+			for (int k = 0; k < 3; k++) {
+				float base = src ? src[s].c[k] : 255.0f;
+				dst[s].c[k] = (unsigned char)std::min(255.0f, base * light[k] + 0.5f);
+			}
+		}
+	});
+	out.mark_all_dirty();
+	return true;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <string>
+#include <cmath>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_upload.h"
+#include "parallel.h"
+
+/* Mip pyramid of mesh colors.
+   Level l + 1 halves the resolution of level l (7, 3, 1 or 8, 4, 2, 1) and every level keeps
+   the per face layout, all of them one after the other in a single array. Coarse samples are
+   tent filtered from the finer level on the triangular lattice:
+   - vertex samples are copied, they are shared with faces the patch knows nothing about,
+   - edge samples filter along the edge only, so both faces of an edge get the same colors,
+   - interior samples filter over the whole fine patch.
+   A model far away binds only its coarse levels, which is all the shader reads from it. */
+
+#define MC_MAX_LEVELS 12
+
+struct mc_mip_chain {
+	unsigned int face_count = 0;
+	//resolution of each level, finest first
+	std::vector<unsigned int> R;
+	//level l starts at colors[level_offset[l]], level_offset has one entry past the last level
+	std::vector<size_t> level_offset;
+	std::vector<rgb> colors;
+
+	unsigned int levels() const { return (unsigned int)R.size(); }
+	rgb* face(unsigned int l, unsigned int f) { return colors.data() + level_offset[l] + size_t(f) * mc_face_samples(R[l]); }
+	const rgb* face(unsigned int l, unsigned int f) const { return colors.data() + level_offset[l] + size_t(f) * mc_face_samples(R[l]); }
+};
+
+namespace {
+	struct mip_tap {
+		unsigned int slot;
+		float weight;
+	};
+
+	//lattice point (i, j, k) on the plane, neighbours one unit apart
+	glm::vec2 lattice_point(const glm::vec3& g)
+	{
+		return glm::vec2(g.y + 0.5f * g.z, 0.86602540378f * g.z);
+	}
+
+	/* filter taps of every coarse slot, taps[offsets[s] .. offsets[s + 1]) to be divided by
+	   norm[s]. Edge weights are whole numbers so an edge sums to the same value from both
+	   of its faces, whatever the order of the taps. */
+	void mip_taps(unsigned int fine_r, unsigned int coarse_r, std::vector<mip_tap>& taps, std::vector<unsigned int>& offsets, std::vector<float>& norm)
+	{
+		unsigned int spf = mc_face_samples(coarse_r);
+		unsigned int fine_spf = mc_face_samples(fine_r);
+		unsigned int fine_e = mc_edge_samples(fine_r);
+		unsigned int coarse_e = mc_edge_samples(coarse_r);
+		float h = float(fine_r) / float(coarse_r);
+		taps.clear();
+		offsets.assign(1, 0);
+		norm.clear();
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			size_t first = taps.size();
+			if (s < 3) {
+				taps.push_back({ s, 1.0f });
+			}
+			else if (s < 3 + 3 * coarse_e) {
+				//along edge k -> k+1, fine point m sits at m units from corner k, the tent
+				//1 - |m - x| / h scaled by fine_r
+				unsigned int k = (s - 3) / coarse_e;
+				int x = int((s - 3) % coarse_e + 1);
+				for (unsigned int m = 0; m <= fine_r; m++)
+				{
+					int w = int(fine_r) - std::abs(int(m * coarse_r) - x * int(fine_r));
+					if (w <= 0) {
+						continue;
+					}
+					unsigned int slot = m == 0 ? k : m == fine_r ? (k + 1) % 3 : 3 + k * fine_e + (m - 1);
+					taps.push_back({ slot, float(w) });
+				}
+			}
+			else {
+				glm::vec2 p = lattice_point(glm::vec3(mc_slot_grid(coarse_r, s)) * h);
+				for (unsigned int t = 0; t < fine_spf; t++)
+				{
+					float w = 1.0f - glm::length(lattice_point(glm::vec3(mc_slot_grid(fine_r, t))) - p) / h;
+					if (w > 0.0f) {
+						taps.push_back({ t, w });
+					}
+				}
+			}
+			float sum = 0.0f;
+			for (size_t i = first; i < taps.size(); i++) {
+				sum += taps[i].weight;
+			}
+			norm.push_back(sum);
+			offsets.push_back((unsigned int)taps.size());
+		}
+	}
+};
+
+//builds every level of the pyramid from base, down to resolution min_R
+void build_mc_mip_chain(const mc_buffer& base, mc_mip_chain& out, unsigned int min_R = 1)
+{
+	out.face_count = base.face_count;
+	out.R.assign(1, base.R);
+	while (out.R.back() > std::max(1u, min_R) && out.R.size() < MC_MAX_LEVELS) {
+		out.R.push_back(std::max(std::max(1u, min_R), out.R.back() / 2));
+	}
+	out.level_offset.assign(1, 0);
+	for (unsigned int r : out.R) {
+		out.level_offset.push_back(out.level_offset.back() + size_t(out.face_count) * mc_face_samples(r));
+	}
+	out.colors.resize(out.level_offset.back());
+	std::copy(base.colors.begin(), base.colors.end(), out.colors.begin());
+
+	std::vector<mip_tap> taps;
+	std::vector<unsigned int> offsets;
+	std::vector<float> norm;
+	for (unsigned int l = 1; l < out.levels(); l++)
+	{
+		mip_taps(out.R[l - 1], out.R[l], taps, offsets, norm);
+		unsigned int spf = mc_face_samples(out.R[l]);
+		parallel_for(0, out.face_count, [&](size_t fi) {
+			unsigned int f = (unsigned int)fi;
+			const rgb* src = out.face(l - 1, f);
+			rgb* dst = out.face(l, f);
+			for (unsigned int s = 0; s < spf; s++)
+			{
+				float c[3] = { 0.0f, 0.0f, 0.0f };
+				for (unsigned int t = offsets[s]; t < offsets[s + 1]; t++) {
+					for (int k = 0; k < 3; k++) {
+						c[k] += taps[t].weight * src[taps[t].slot].c[k];
+					}
+				}
+				dst[s] = rgb(int(c[0] / norm[s] + 0.5f), int(c[1] / norm[s] + 0.5f), int(c[2] / norm[s] + 0.5f));
+			}
+		});
+	}
+}
+
+/* Level selection, the same rule the mesh_colors_mip shader applies per pixel: with a face
+   edge covering edge_pixels pixels, the finest level with at most one sample per pixel. */
+unsigned int mc_mip_select(const mc_mip_chain& c, float edge_pixels)
+{
+	for (unsigned int l = 0; l < c.levels(); l++) {
+		if (float(c.R[l]) <= edge_pixels) {
+			return l;
+		}
+	}
+	return c.levels() - 1;
+}
+
+/* Levels [first, levels) of a chain on the gpu, one rgba8 texel per sample */
+class mc_mip_gpu {
+public:
+	//uploads the levels from first on, only they take gpu memory
+	void upload(const mc_mip_chain& c, unsigned int first)
+	{
+		first_level = std::min(first, c.levels() - 1);
+		size_t begin = c.level_offset[first_level];
+		buffer.upload(c.colors.data() + begin, c.colors.size() - begin);
+		R.assign(c.R.begin() + first_level, c.R.end());
+		offsets.clear();
+		for (unsigned int l = first_level; l < c.levels(); l++) {
+			offsets.push_back(int(c.level_offset[l] - begin));
+		}
+	}
+
+	//level uniforms of the mesh_colors_mip shader
+	void set_uniforms(const Shader& s, float lod_bias = 0.0f) const
+	{
+		s.setInt("mc_levels", int(R.size()));
+		s.setFloat("mc_lod_bias", lod_bias);
+		for (size_t l = 0; l < R.size(); l++)
+		{
+			s.setInt("mc_level_R[" + std::to_string(l) + "]", int(R[l]));
+			s.setInt("mc_level_offset[" + std::to_string(l) + "]", offsets[l]);
+		}
+	}
+
+	void bind(unsigned int unit) { buffer.bind(unit); }
+
+	unsigned int first_level = 0;
+
+private:
+	mc_gpu_buffer buffer;
+	std::vector<unsigned int> R;
+	std::vector<int> offsets;
+};
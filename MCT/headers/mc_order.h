@@ -0,0 +1,183 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "parallel.h"
+
+/* Spatially coherent face order.
+   Scanned meshes list their faces in an order that jumps all over the uv map, so the bake
+   reads texels far from the ones it just read and the scatter writes are just as spread.
+   Sorting faces along a Hilbert curve of their uv centroid makes consecutive faces cover
+   neighbouring texels, sorting by the 3d centroid does the same for the vertex cache and
+   the gpu. The order keeps the permutation both ways, so results can be written back in
+   the original face order. */
+
+struct face_order {
+	//new face n was face old_face[n], old face f is now new_face[f]
+	std::vector<unsigned int> old_face;
+	std::vector<unsigned int> new_face;
+};
+
+//distance along the Hilbert curve of the 2^16 x 2^16 grid
+uint64_t hilbert_index_2d(uint32_t x, uint32_t y)
+{
+	uint64_t d = 0;
+	for (uint32_t s = 1u << 15; s > 0; s >>= 1)
+	{
+		uint32_t rx = (x & s) ? 1 : 0;
+		uint32_t ry = (y & s) ? 1 : 0;
+		d += uint64_t(s) * s * ((3 * rx) ^ ry);
+		//rotate the quadrant
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - (x & (s - 1));
+				y = s - 1 - (y & (s - 1));
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+//distance along the Hilbert curve of the 2^bits cube, bits <= 21, Skilling's transpose form
+uint64_t hilbert_index_3d(uint32_t x, uint32_t y, uint32_t z, unsigned int bits = 21)
+{
+	uint32_t v[3] = { x, y, z };
+	uint32_t m = 1u << (bits - 1);
+	//undo excess work, AxestoTranspose
+	for (uint32_t q = m; q > 1; q >>= 1)
+	{
+		uint32_t p = q - 1;
+		for (int i = 0; i < 3; i++)
+		{
+			if (v[i] & q) {
+				v[0] ^= p;
+			}
+			else {
+				uint32_t t = (v[0] ^ v[i]) & p;
+				v[0] ^= t;
+				v[i] ^= t;
+			}
+		}
+	}
+	//gray encode
+	for (int i = 1; i < 3; i++) {
+		v[i] ^= v[i - 1];
+	}
+	uint32_t t = 0;
+	for (uint32_t q = m; q > 1; q >>= 1) {
+		if (v[2] & q) {
+			t ^= q - 1;
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		v[i] ^= t;
+	}
+	//interleave the transposed bits, most significant first
+	uint64_t d = 0;
+	for (int b = int(bits) - 1; b >= 0; b--) {
+		for (int i = 0; i < 3; i++) {
+			d = (d << 1) | ((v[i] >> b) & 1);
+		}
+	}
+	return d;
+}
+
+namespace {
+	//sorts faces by key and fills both directions of the permutation
+	void order_by_keys(std::vector<uint64_t>& keys, face_order& out)
+	{
+		unsigned int faces = (unsigned int)keys.size();
+		out.old_face.resize(faces);
+		for (unsigned int f = 0; f < faces; f++) {
+			out.old_face[f] = f;
+		}
+		std::stable_sort(out.old_face.begin(), out.old_face.end(), [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+		out.new_face.resize(faces);
+		parallel_for(0, faces, [&](size_t n) { out.new_face[out.old_face[n]] = (unsigned int)n; });
+	}
+};
+
+//faces along a Hilbert curve of their uv centroids, for baking and scattering
+void order_faces_uv(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, face_order& out)
+{
+	unsigned int faces = (unsigned int)(inds.size() / 3);
+	glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+	for (const vertex& v : verts)
+	{
+		lo = glm::min(lo, v.uv);
+		hi = glm::max(hi, v.uv);
+	}
+	glm::vec2 scale = 65535.0f / glm::max(hi - lo, glm::vec2(1e-12f));
+	std::vector<uint64_t> keys(faces);
+	parallel_for(0, faces, [&](size_t f) {
+		glm::vec2 c = (verts[inds[3 * f]].uv + verts[inds[3 * f + 1]].uv + verts[inds[3 * f + 2]].uv) / 3.0f;
+		glm::vec2 q = glm::clamp((c - lo) * scale, glm::vec2(0.0f), glm::vec2(65535.0f));
+		keys[f] = hilbert_index_2d(uint32_t(q.x), uint32_t(q.y));
+	});
+	order_by_keys(keys, out);
+}
+
+//faces along a Hilbert curve of their 3d centroids, for rendering
+void order_faces_3d(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, face_order& out)
+{
+	unsigned int faces = (unsigned int)(inds.size() / 3);
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (const vertex& v : verts)
+	{
+		lo = glm::min(lo, v.pos);
+		hi = glm::max(hi, v.pos);
+	}
+	//one scale for all axes keeps the curve from stretching along the long side
+	float cells = float((1 << 21) - 1);
+	float scale = cells / std::max(1e-12f, std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z)));
+	std::vector<uint64_t> keys(faces);
+	parallel_for(0, faces, [&](size_t f) {
+		glm::vec3 c = (verts[inds[3 * f]].pos + verts[inds[3 * f + 1]].pos + verts[inds[3 * f + 2]].pos) / 3.0f;
+		glm::vec3 q = glm::clamp((c - lo) * scale, glm::vec3(0.0f), glm::vec3(cells));
+		keys[f] = hilbert_index_3d(uint32_t(q.x), uint32_t(q.y), uint32_t(q.z));
+	});
+	order_by_keys(keys, out);
+}
+
+//index buffer in the new face order
+void reorder_indices(const std::vector<unsigned int>& inds, const face_order& o, std::vector<unsigned int>& out)
+{
+	out.resize(inds.size());
+	parallel_for(0, o.old_face.size(), [&](size_t n) {
+		size_t f = o.old_face[n];
+		out[3 * n + 0] = inds[3 * f + 0];
+		out[3 * n + 1] = inds[3 * f + 1];
+		out[3 * n + 2] = inds[3 * f + 2];
+	});
+}
+
+//reorders the faces of a model and its index buffer on the gpu
+void reorder_model_faces(Model& m, const face_order& o)
+{
+	std::vector<unsigned int> inds;
+	reorder_indices(m.indices, o, inds);
+	m.indices.swap(inds);
+	GLCall(glBindVertexArray(m.vao));
+	GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo));
+	GLCall(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, m.indices.size() * sizeof(unsigned int), m.indices.data()));
+	GLCall(glBindVertexArray(0));
+}
+
+//patches of b, baked in the order o, back in the original face order
+void restore_face_order(const mc_buffer& b, const face_order& o, mc_buffer& out)
+{
+	out.resize(b.R, b.face_count);
+	parallel_for(0, b.face_count, [&](size_t f) {
+		const rgb* src = b.face(o.new_face[f]);
+		std::copy(src, src + mc_face_samples(b.R), out.face((unsigned int)f));
+	});
+	out.mark_all_dirty();
+}
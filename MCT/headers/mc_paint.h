@@ -0,0 +1,118 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "bvh.h"
+#include "mc_history.h"
+
+/* 3D brush painting on mesh colors.
+   The cursor is turned into a model space ray and picked against a bvh of the Model, the
+   brush then blends every mesh color sample within its radius of the hit point. */
+
+struct brush {
+	rgb color = rgb(255, 0, 0);
+	//world space radius
+	float radius = 0.1f;
+	//0 gives a linear falloff, 1 a hard edge
+	float hardness = 0.5f;
+	float strength = 1.0f;
+};
+
+//model space ray under the cursor, x and y in window pixels
+ray screen_ray(double x, double y, const camera_props& cam, const glm::mat4& M)
+{
+	float nx = float(2.0 * x / cam.width - 1.0);
+	float ny = float(1.0 - 2.0 * y / cam.height);
+	glm::mat4 inv = glm::inverse(cam.P * cam.V * M);
+	glm::vec4 n = inv * glm::vec4(nx, ny, -1.0f, 1.0f);
+	glm::vec4 f = inv * glm::vec4(nx, ny, 1.0f, 1.0f);
+	ray r;
+	r.o = glm::vec3(n) / n.w;
+	r.d = glm::normalize(glm::vec3(f) / f.w - r.o);
+	return r;
+}
+
+//model space point under the cursor
+bool pick_surface(const bvh& tree, double x, double y, const camera_props& cam, const glm::mat4& M, glm::vec3& p, ray_hit& hit)
+{
+	ray r = screen_ray(x, y, cam, M);
+	hit = ray_hit();
+	if (!tree.intersect(r, hit)) {
+		return false;
+	}
+	p = r.o + r.d * hit.t;
+	return true;
+}
+
+/* Applies a brush to mesh colors, the faces are found through the bvh so the cost follows
+   the painted area rather than the model size */
+class mc_painter {
+public:
+	mc_painter(const bvh& t, mc_buffer& c, mc_history* h = nullptr) : tree(t), colors(c), history(h) {}
+
+	//one stroke sample at model space center, scale is the model matrix scale to world units
+	void dab(const glm::vec3& center, const brush& b, float scale = 1.0f)
+	{
+		float radius = b.radius / scale;
+		tree.query_sphere(center, radius, faces);
+		unsigned int spf = mc_face_samples(colors.R);
+		if (bary.size() != spf) {
+			bary.resize(spf);
+			for (unsigned int s = 0; s < spf; s++) {
+				bary[s] = glm::vec3(mc_slot_grid(colors.R, s)) / float(colors.R > 0 ? colors.R : 1);
+			}
+		}
+
+		float r2 = radius * radius;
+		float hard = glm::clamp(b.hardness, 0.0f, 0.999f);
+		for (unsigned int f : faces)
+		{
+			glm::vec3 p0, p1, p2;
+			tree.corners(f, p0, p1, p2);
+			rgb* dst = colors.face(f);
+			bool touched = false;
+			for (unsigned int s = 0; s < spf; s++)
+			{
+				glm::vec3 p = p0 * bary[s].x + p1 * bary[s].y + p2 * bary[s].z;
+				glm::vec3 d = p - center;
+				float d2 = glm::dot(d, d);
+				if (d2 >= r2) {
+					continue;
+				}
+				float falloff = 1.0f - glm::clamp((std::sqrt(d2 / r2) - hard) / (1.0f - hard), 0.0f, 1.0f);
+				float w = std::min(falloff * b.strength, 1.0f);
+				if (!touched && history) {
+					history->before_write_faces(f, f + 1);
+				}
+				for (int k = 0; k < 3; k++) {
+					dst[s].c[k] = (unsigned char)(dst[s].c[k] + (b.color.c[k] - dst[s].c[k]) * w + 0.5f);
+				}
+				touched = true;
+			}
+			if (touched) {
+				colors.mark_dirty(f, f + 1);
+			}
+		}
+	}
+
+	//picks under the cursor and paints there, false when the cursor misses the model
+	bool paint_at(double x, double y, const camera_props& cam, const glm::mat4& M, const brush& b)
+	{
+		glm::vec3 p;
+		ray_hit hit;
+		if (!pick_surface(tree, x, y, cam, M, p, hit)) {
+			return false;
+		}
+		dab(p, b, glm::length(glm::vec3(M[0])));
+		return true;
+	}
+
+private:
+	const bvh& tree;
+	mc_buffer& colors;
+	mc_history* history;
+	std::vector<unsigned int> faces;
+	std::vector<glm::vec3> bary;
+};
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <GLM/glm.hpp>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_upload.h"
+#include "parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MC_PALETTE_SSE 1
+#include <emmintrin.h>
+#endif
+
+/* Palette indexed mesh colors.
+   Stylized assets use a handful of colors, so every sample is replaced by the index of the
+   nearest of N palette colors: 4 bits per sample up to 16 colors (6x smaller than rgb),
+   8 bits up to 256 (3x). The palette comes from k-means over all samples: k-means++ seeds
+   from a random subset, mini-batch updates (Sculley 2010) move the centers with a per
+   center learning rate, then a few full Lloyd passes settle them. Nearest center searches
+   take four samples at a time with SSE. Indices keep the mc_buffer layout, sample s of the
+   buffer is index s. */
+
+struct mc_palette_config {
+	//palette size, at most 256
+	unsigned int entries = 16;
+	unsigned int batch = 4096;
+	unsigned int iterations = 100;
+	//full passes over every sample after the mini-batches
+	unsigned int refine = 3;
+	unsigned int seed = 1;
+};
+
+struct mc_indexed {
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	//4 or 8
+	unsigned int bits = 8;
+	std::vector<rgb> palette;
+	//4 bits: sample s in the low half of byte s/2 when s is even, the high half when odd
+	std::vector<uint8_t> indices;
+	//mean squared error per channel against the source colors
+	float mse = 0.0f;
+
+	size_t samples() const { return size_t(face_count) * mc_face_samples(R); }
+	unsigned int index(size_t s) const
+	{
+		if (bits == 4) {
+			return (indices[s >> 1] >> (4 * (s & 1))) & 15;
+		}
+		return indices[s];
+	}
+	size_t bytes() const { return indices.size() + palette.size() * sizeof(rgb); }
+	float psnr() const { return mse > 0.0f ? 10.0f * std::log10(255.0f * 255.0f / mse) : 99.0f; }
+};
+
+namespace {
+	//four colors in soa form, one per lane
+	struct color4 {
+		float r[4], g[4], b[4];
+	};
+
+	//colors of samples at(0) .. at(count - 1), the lanes past count repeat the last one
+	template<typename F>
+	void load_color4(const mc_buffer& b, unsigned int count, F at, color4& c)
+	{
+		for (unsigned int l = 0; l < 4; l++)
+		{
+			const rgb& x = b.colors[at(std::min(l, count - 1))];
+			c.r[l] = x.c[0];
+			c.g[l] = x.c[1];
+			c.b[l] = x.c[2];
+		}
+	}
+
+	//nearest center of each of the four colors and its squared distance
+	void nearest_centers(const std::vector<glm::vec3>& centers, const color4& c, unsigned int* idx, float* dist)
+	{
+#ifdef MC_PALETTE_SSE
+		__m128 r = _mm_loadu_ps(c.r), g = _mm_loadu_ps(c.g), b = _mm_loadu_ps(c.b);
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i best_i = _mm_setzero_si128();
+		for (unsigned int m = 0; m < centers.size(); m++)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(centers[m].x));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(centers[m].y));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(centers[m].z));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(d, best);
+			best_i = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(int(m))), _mm_andnot_si128(closer, best_i));
+		}
+		_mm_storeu_ps(dist, best);
+		_mm_storeu_si128((__m128i*)idx, best_i);
+#else
+		for (int l = 0; l < 4; l++)
+		{
+			glm::vec3 x(c.r[l], c.g[l], c.b[l]);
+			idx[l] = 0;
+			dist[l] = FLT_MAX;
+			for (unsigned int m = 0; m < centers.size(); m++)
+			{
+				glm::vec3 d = centers[m] - x;
+				float d2 = glm::dot(d, d);
+				if (d2 < dist[l]) {
+					dist[l] = d2;
+					idx[l] = m;
+				}
+			}
+		}
+#endif
+	}
+
+	glm::vec3 sample_color(const mc_buffer& b, size_t s)
+	{
+		const rgb& c = b.colors[s];
+		return glm::vec3(c.c[0], c.c[1], c.c[2]);
+	}
+
+	//k-means++ over a random subset of the samples
+	void seed_centers(const mc_buffer& b, unsigned int k, std::mt19937& rng, std::vector<glm::vec3>& centers)
+	{
+		size_t n = b.colors.size();
+		std::vector<glm::vec3> pool(std::min<size_t>(n, size_t(64) * k));
+		std::uniform_int_distribution<size_t> pick(0, n - 1);
+		for (glm::vec3& p : pool) {
+			p = sample_color(b, pick(rng));
+		}
+		centers.assign(1, pool[0]);
+		std::vector<float> d2(pool.size(), FLT_MAX);
+		std::uniform_real_distribution<float> u(0.0f, 1.0f);
+		while (centers.size() < k)
+		{
+			//distance to the closest center so far, the next center is drawn in proportion to it
+			double total = 0.0;
+			for (size_t i = 0; i < pool.size(); i++)
+			{
+				glm::vec3 d = pool[i] - centers.back();
+				d2[i] = std::min(d2[i], glm::dot(d, d));
+				total += d2[i];
+			}
+			if (total <= 0.0) {
+				//fewer distinct colors than entries, the rest repeat the first
+				centers.resize(k, centers[0]);
+				break;
+			}
+			double t = u(rng) * total;
+			size_t i = 0;
+			for (; i + 1 < pool.size() && t > d2[i]; i++) {
+				t -= d2[i];
+			}
+			centers.push_back(pool[i]);
+		}
+	}
+};
+
+//clusters the samples of b in cfg.entries colors
+void quantize_mc_colors(const mc_buffer& b, const mc_palette_config& cfg, mc_indexed& out)
+{
+	size_t n = b.colors.size();
+	out.R = b.R;
+	out.face_count = b.face_count;
+	out.mse = 0.0f;
+	if (n == 0) {
+		out.palette.clear();
+		out.indices.clear();
+		return;
+	}
+	unsigned int k = std::max(1u, std::min(cfg.entries, 256u));
+	out.bits = k <= 16 ? 4 : 8;
+	std::mt19937 rng(cfg.seed);
+	std::vector<glm::vec3> centers;
+	seed_centers(b, k, rng, centers);
+	//groups of four samples, the last one can be short
+	size_t groups = (n + 3) / 4;
+	auto group_size = [&](size_t q) { return unsigned(std::min<size_t>(4, n - 4 * q)); };
+
+	//mini-batches, a center that has seen m samples moves 1/m of the way to the next one
+	std::vector<unsigned int> seen(k, 0);
+	std::vector<size_t> batch(std::min<size_t>(cfg.batch, n));
+	std::vector<unsigned int> nearest(batch.size() + 3);
+	std::uniform_int_distribution<size_t> pick(0, n - 1);
+	for (unsigned int it = 0; it < cfg.iterations; it++)
+	{
+		for (size_t& s : batch) {
+			s = pick(rng);
+		}
+		parallel_for(0, (batch.size() + 3) / 4, [&](size_t q) {
+			color4 c;
+			float d[4];
+			load_color4(b, unsigned(std::min<size_t>(4, batch.size() - 4 * q)), [&](unsigned int l) { return batch[4 * q + l]; }, c);
+			nearest_centers(centers, c, &nearest[4 * q], d);
+		});
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			unsigned int c = nearest[i];
+			seen[c]++;
+			centers[c] += (sample_color(b, batch[i]) - centers[c]) / float(seen[c]);
+		}
+	}
+
+	//full Lloyd passes, per worker sums added in block order
+	unsigned int workers = worker_count();
+	for (unsigned int pass = 0; pass < cfg.refine; pass++)
+	{
+		std::vector<glm::dvec3> sums(size_t(workers) * k, glm::dvec3(0.0));
+		std::vector<size_t> counts(size_t(workers) * k, 0);
+		//farthest sample of every block, reseeds empty clusters
+		std::vector<std::pair<float, size_t>> far(workers, std::make_pair(-1.0f, size_t(0)));
+		parallel_blocks(0, groups, workers, [&](size_t q0, size_t q1, unsigned int blk) {
+			glm::dvec3* sum = &sums[size_t(blk) * k];
+			size_t* count = &counts[size_t(blk) * k];
+			for (size_t q = q0; q < q1; q++)
+			{
+				color4 c;
+				unsigned int m[4];
+				float d[4];
+				unsigned int size = group_size(q);
+				load_color4(b, size, [&](unsigned int l) { return 4 * q + l; }, c);
+				nearest_centers(centers, c, m, d);
+				for (unsigned int l = 0; l < size; l++)
+				{
+					sum[m[l]] += glm::dvec3(c.r[l], c.g[l], c.b[l]);
+					count[m[l]]++;
+					if (d[l] > far[blk].first) far[blk] = std::make_pair(d[l], 4 * q + l);
+				}
+			}
+		});
+		for (unsigned int c = 0; c < k; c++)
+		{
+			glm::dvec3 sum(0.0);
+			size_t count = 0;
+			for (unsigned int w = 0; w < workers; w++)
+			{
+				sum += sums[size_t(w) * k + c];
+				count += counts[size_t(w) * k + c];
+			}
+			if (count > 0) {
+				centers[c] = glm::vec3(sum / double(count));
+			}
+			else {
+				auto f = std::max_element(far.begin(), far.end());
+				centers[c] = sample_color(b, f->second);
+				f->first = -1.0f;
+			}
+		}
+	}
+
+	//indices against the rounded palette
+	out.palette.resize(k);
+	for (unsigned int c = 0; c < k; c++)
+	{
+		glm::vec3 q = glm::clamp(glm::round(centers[c]), glm::vec3(0.0f), glm::vec3(255.0f));
+		out.palette[c] = rgb(int(q.x), int(q.y), int(q.z));
+		centers[c] = q;
+	}
+	out.indices.assign(out.bits == 4 ? (n + 1) / 2 : n, 0);
+	std::vector<double> error(workers, 0.0);
+	//a group of four samples fills whole bytes, so blocks never write the same byte
+	parallel_blocks(0, groups, workers, [&](size_t q0, size_t q1, unsigned int blk) {
+		for (size_t q = q0; q < q1; q++)
+		{
+			color4 c;
+			unsigned int m[4];
+			float d[4];
+			unsigned int size = group_size(q);
+			load_color4(b, size, [&](unsigned int l) { return 4 * q + l; }, c);
+			nearest_centers(centers, c, m, d);
+			for (unsigned int l = 0; l < size; l++)
+			{
+				size_t s = 4 * q + l;
+				error[blk] += d[l];
+				if (out.bits == 4) out.indices[s >> 1] |= uint8_t(m[l] << (4 * (s & 1)));
+				else out.indices[s] = uint8_t(m[l]);
+			}
+		}
+	});
+	double total = 0.0;
+	for (double e : error) {
+		total += e;
+	}
+	out.mse = float(total / (3.0 * double(n)));
+}
+
+//expands c back to colors
+void decode_mc_indexed(const mc_indexed& c, mc_buffer& out)
+{
+	out.resize(c.R, c.face_count);
+	parallel_for(0, out.colors.size(), [&](size_t s) { out.colors[s] = c.palette[c.index(s)]; });
+	out.mark_all_dirty();
+}
+
+/* Indexed mesh colors on the gpu, the palette as colors and one r8ui texel per index byte */
+class mc_indexed_gpu {
+public:
+	~mc_indexed_gpu()
+	{
+		if (index_texture) glDeleteTextures(1, &index_texture);
+		if (index_buffer) glDeleteBuffers(1, &index_buffer);
+	}
+
+	void upload(const mc_indexed& c)
+	{
+		palette.upload(c.palette.data(), c.palette.size());
+		if (index_buffer == 0) {
+			GLCall(glGenBuffers(1, &index_buffer));
+			GLCall(glGenTextures(1, &index_texture));
+		}
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, index_buffer));
+		GLCall(glBufferData(GL_TEXTURE_BUFFER, c.indices.size(), c.indices.data(), GL_DYNAMIC_DRAW));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, index_texture));
+		GLCall(glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, index_buffer));
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+		R = c.R;
+		bits = c.bits;
+	}
+
+	//uniforms of the mesh_colors_indexed shader
+	void set_uniforms(const Shader& s) const
+	{
+		s.setInt("mc_R", int(R));
+		s.setInt("mc_index_bits", int(bits));
+	}
+
+	//palette on unit, indices on unit + 1
+	void bind(unsigned int unit)
+	{
+		palette.bind(unit);
+		GLCall(glActiveTexture(GL_TEXTURE0 + unit + 1));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, index_texture));
+	}
+
+private:
+	mc_gpu_buffer palette;
+	GLuint index_buffer = 0;
+	GLuint index_texture = 0;
+	unsigned int R = 0;
+	unsigned int bits = 8;
+};
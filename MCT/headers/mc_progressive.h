@@ -0,0 +1,449 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_compact.h"
+#include "topology.h"
+#include "mc_stream.h"
+#include "parallel.h"
+
+/* Progressive mesh colors files, coarse to fine.
+   Samples are sent in levels of growing resolution r = 1, 3, 7, 15 .. R. Level 0 is the
+   vertex colors, every later level the edge samples then the interior samples the r grid
+   of a face lands on that no earlier level sent. Once a face has level l it is shown as
+   its r patch interpolated up to R, the samples already there kept as they are; faces get
+   the next level one by one as its interiors arrive. At R = 7 the vertices are 2% of the
+   file and every face has its r = 3 patch after a fifth of it.
+   r is odd so rounding the r grid onto the R grid never ties, a shared edge picks the same
+   samples from both of its faces. Samples are the welded ones of mc_compact, faces whose
+   boundary disagrees with it (painted seams) come last with their own boundary samples.
+   Samples are raw rgb and the place of every byte follows from the header, so a reader
+   fed from a file, a pipe or a socket can put them in place as they arrive.
+   File: mc_file_header (count0 R, count1 faces), vertex, edge and seam face counts, the
+   levels, then every seam face as its index and boundary samples. */
+
+//progressive colors: count0 resolution R, count1 faces
+const char mc_progressive_magic[4] = { 'M', 'C', 'P', 'G' };
+
+//what every level sends of an edge and of a face interior
+struct progressive_plan {
+	unsigned int R = 0;
+	//resolution of each level, the last one is R
+	std::vector<unsigned int> res;
+	//first level holding each face patch slot
+	std::vector<unsigned int> slot_level;
+	//samples m of an edge sent by each level
+	std::vector<std::vector<unsigned int>> edge_m;
+	//interior face patch slots sent by each level
+	std::vector<std::vector<unsigned int>> interior;
+};
+
+namespace {
+	//grid point (a, b) of resolution r rounded onto the R grid
+	glm::uvec3 coarse_point(unsigned int a, unsigned int b, unsigned int r, unsigned int R)
+	{
+		unsigned int i = (2 * a * R + r) / (2 * r);
+		unsigned int ij = (2 * (a + b) * R + r) / (2 * r);
+		return glm::uvec3(i, ij - i, R - ij);
+	}
+
+	void build_progressive_plan(unsigned int R, progressive_plan& p)
+	{
+		p.R = R;
+		p.res.clear();
+		for (unsigned int r = 1; r < R; r = 2 * r + 1) {
+			p.res.push_back(r);
+		}
+		p.res.push_back(std::max(R, 1u));
+		unsigned int levels = (unsigned int)p.res.size();
+		p.slot_level.assign(mc_face_samples(R), levels - 1);
+		for (unsigned int l = 0; l < levels; l++)
+		{
+			unsigned int r = p.res[l];
+			for (unsigned int a = 0; a <= r; a++) {
+				for (unsigned int b = 0; a + b <= r; b++)
+				{
+					glm::uvec3 g = coarse_point(a, b, r, R);
+					unsigned int& s = p.slot_level[mc_grid_slot(R, g.x, g.y, g.z)];
+					s = std::min(s, l);
+				}
+			}
+		}
+		//edge samples m as the first edge of a face has them, the odd r make both directions agree
+		unsigned int e = mc_edge_samples(R);
+		p.edge_m.assign(levels, std::vector<unsigned int>());
+		p.interior.assign(levels, std::vector<unsigned int>());
+		for (unsigned int m = 1; m <= e; m++) {
+			p.edge_m[p.slot_level[3 + (m - 1)]].push_back(m);
+		}
+		for (unsigned int s = 3 + 3 * e; s < p.slot_level.size(); s++) {
+			p.interior[p.slot_level[s]].push_back(s);
+		}
+	}
+
+	//samples of level l over a mesh of V vertices, E edges and F faces
+	size_t progressive_level_samples(const progressive_plan& p, unsigned int l, size_t V, size_t E, size_t F)
+	{
+		return (l == 0 ? V : 0) + E * p.edge_m[l].size() + F * p.interior[l].size();
+	}
+
+	//true if face f of b has the boundary samples the compact layout keeps for it
+	bool matches_compact(const mc_buffer& b, const mc_compact& c, unsigned int f)
+	{
+		const rgb* src = b.face(f);
+		unsigned int n = 3 + 3 * mc_edge_samples(b.R);
+		for (unsigned int s = 0; s < n; s++)
+		{
+			glm::uvec3 g = mc_slot_grid(b.R, s);
+			if (!(src[s] == c.colors[c.slot(f, g.x, g.y, g.z)])) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+/* writes the colors of b, faces of topo, in coarse to fine order */
+bool save_mc_progressive(const mc_buffer& b, const mesh_topology& topo, const char* path)
+{
+	if (b.face_count != topo.face_count() || b.R == 0) {
+		std::cout << "colors do not match the mesh topology" << std::endl;
+		return false;
+	}
+	progressive_plan p;
+	build_progressive_plan(b.R, p);
+	mc_compact c;
+	build_mc_compact(b, topo, c);
+
+	std::vector<unsigned char> seam(c.face_count);
+	parallel_for(0, c.face_count, [&](size_t f) { seam[f] = !matches_compact(b, c, (unsigned int)f); });
+	std::vector<unsigned int> seam_faces;
+	for (unsigned int f = 0; f < c.face_count; f++) {
+		if (seam[f]) seam_faces.push_back(f);
+	}
+
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	mc_file_header h;
+	make_header(h, mc_progressive_magic, b.R, c.face_count);
+	uint32_t counts[4] = { c.vertex_count, c.edge_count, (uint32_t)seam_faces.size(), 0 };
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)counts, sizeof(counts));
+
+	std::vector<rgb> level;
+	for (unsigned int l = 0; l < p.res.size(); l++)
+	{
+		const std::vector<unsigned int>& em = p.edge_m[l];
+		const std::vector<unsigned int>& fs = p.interior[l];
+		size_t vn = l == 0 ? c.vertex_count : 0;
+		size_t en = size_t(c.edge_count) * em.size();
+		level.resize(progressive_level_samples(p, l, c.vertex_count, c.edge_count, c.face_count));
+		std::copy(c.colors.begin(), c.colors.begin() + vn, level.begin());
+		parallel_for(0, em.empty() ? 0 : c.edge_count, [&](size_t e) {
+			for (size_t n = 0; n < em.size(); n++) {
+				level[vn + e * em.size() + n] = c.colors[c.edge_slot((unsigned int)e, em[n])];
+			}
+		});
+		parallel_for(0, fs.empty() ? 0 : c.face_count, [&](size_t f) {
+			const rgb* src = b.face((unsigned int)f);
+			for (size_t n = 0; n < fs.size(); n++) {
+				level[vn + en + f * fs.size() + n] = src[fs[n]];
+			}
+		});
+		out.write((const char*)level.data(), level.size() * sizeof(rgb));
+	}
+	unsigned int boundary = 3 + 3 * mc_edge_samples(b.R);
+	for (unsigned int f : seam_faces)
+	{
+		uint32_t id = f;
+		out.write((const char*)&id, sizeof(id));
+		out.write((const char*)b.face(f), boundary * sizeof(rgb));
+	}
+	return bool(out);
+}
+
+/* Rebuilds mesh colors from a progressive file while it arrives.
+   feed() takes the bytes in order in whatever pieces they come, refine() updates an
+   mc_buffer with the best colors they allow. The topology is the one of the mesh the file
+   was written for. */
+class mc_progressive_reader {
+public:
+	mc_progressive_reader(const mesh_topology& t) : topo(t) {}
+
+	//takes the next n bytes of the file, false once they turned out not to be a file for this mesh
+	bool feed(const unsigned char* data, size_t n)
+	{
+		if (failed) {
+			return false;
+		}
+		size_t header_bytes = sizeof(mc_file_header) + sizeof(counts);
+		if (!header_ok)
+		{
+			size_t take = std::min(n, header_bytes - head.size());
+			head.insert(head.end(), data, data + take);
+			data += take;
+			n -= take;
+			if (head.size() < header_bytes || !start()) {
+				return !failed;
+			}
+		}
+		//bytes of a sample split between two feeds wait in carry
+		while (n > 0 && received < samples)
+		{
+			if (carry_bytes > 0 || n < sizeof(rgb))
+			{
+				size_t take = std::min(n, sizeof(rgb) - carry_bytes);
+				std::memcpy(carry + carry_bytes, data, take);
+				carry_bytes += take;
+				data += take;
+				n -= take;
+				if (carry_bytes == sizeof(rgb)) {
+					std::memcpy(&target(received), carry, sizeof(rgb));
+					received++;
+					carry_bytes = 0;
+				}
+				continue;
+			}
+			size_t whole = std::min(n / sizeof(rgb), samples - received);
+			place(data, received, received + whole);
+			received += whole;
+			data += whole * sizeof(rgb);
+			n -= whole * sizeof(rgb);
+		}
+		//seam faces are few, they wait whole until the end
+		size_t take = std::min(n, seam_bytes - seams.size());
+		seams.insert(seams.end(), data, data + take);
+		return true;
+	}
+
+	unsigned int level_count() const { return (unsigned int)plan.res.size(); }
+
+	//levels every face has, 0 before the vertices are all there
+	unsigned int levels_done() const
+	{
+		unsigned int l = 0;
+		while (l < level_count() && level_end[l] <= received) {
+			l++;
+		}
+		return l;
+	}
+
+	bool done() const { return header_ok && received == samples && seams.size() == seam_bytes; }
+
+	//fraction of the file that arrived
+	float progress() const
+	{
+		if (!header_ok) return 0.0f;
+		return float(double(received * sizeof(rgb) + seams.size()) / double(samples * sizeof(rgb) + seam_bytes));
+	}
+
+	/* brings out up to date with what arrived: faces are filled from the finest level they
+	   have, only the ones that changed are written and marked dirty. Returns whether any was. */
+	bool refine(mc_buffer& out)
+	{
+		unsigned int levels = levels_done();
+		if (levels == 0) {
+			return false;
+		}
+		if (out.R != plan.R || out.face_count != c.face_count)
+		{
+			out.resize(plan.R, c.face_count);
+			shown_levels = 0;
+		}
+		unsigned int L = levels - 1;
+		//faces of level L+1 whose interiors are in, once all its edge samples are
+		unsigned int faces = 0;
+		if (levels < level_count())
+		{
+			size_t face_begin = level_end[L] + size_t(c.edge_count) * plan.edge_m[levels].size();
+			size_t per_face = plan.interior[levels].size();
+			if (received >= face_begin) {
+				faces = per_face == 0 ? c.face_count : (unsigned int)std::min<size_t>(c.face_count, (received - face_begin) / per_face);
+			}
+		}
+		bool changed = false;
+		if (levels != shown_levels)
+		{
+			fill_faces(out, 0, faces, levels + 1);
+			fill_faces(out, faces, c.face_count, levels);
+			out.mark_all_dirty();
+			shown_levels = levels;
+			seams_shown = false;
+			changed = true;
+		}
+		else if (faces > shown_faces)
+		{
+			fill_faces(out, shown_faces, faces, levels + 1);
+			out.mark_dirty(shown_faces, faces);
+			changed = true;
+		}
+		shown_faces = faces;
+		if (done() && !seams_shown)
+		{
+			unsigned int boundary = 3 + 3 * mc_edge_samples(plan.R);
+			size_t record = sizeof(uint32_t) + boundary * sizeof(rgb);
+			for (size_t s = 0; s + record <= seams.size(); s += record)
+			{
+				uint32_t f;
+				std::memcpy(&f, seams.data() + s, sizeof(f));
+				if (f >= c.face_count) {
+					continue;
+				}
+				std::memcpy(out.face(f), seams.data() + s + sizeof(f), boundary * sizeof(rgb));
+				out.mark_dirty(f, f + 1);
+			}
+			seams_shown = true;
+			changed = changed || !seams.empty();
+		}
+		return changed;
+	}
+
+private:
+	//checks the header against the mesh and lays out the samples to come
+	bool start()
+	{
+		mc_file_header h;
+		std::memcpy(&h, head.data(), sizeof(h));
+		std::memcpy(counts, head.data() + sizeof(h), sizeof(counts));
+		if (std::memcmp(h.magic, mc_progressive_magic, 4) != 0 || h.version != 1 ||
+			h.count0 == 0 || h.count0 > mc_colors_max_R) {
+			std::cout << "unexpected progressive colors format" << std::endl;
+			failed = true;
+			return false;
+		}
+		if (h.count1 != topo.face_count() || counts[0] != topo.vertex_count() || counts[1] != topo.edge_count() || counts[2] > h.count1) {
+			std::cout << "progressive colors were made for another mesh" << std::endl;
+			failed = true;
+			return false;
+		}
+		build_progressive_plan((unsigned int)h.count0, plan);
+		layout_mc_compact(topo, plan.R, c);
+		level_end.resize(level_count());
+		samples = 0;
+		for (unsigned int l = 0; l < level_count(); l++)
+		{
+			samples += progressive_level_samples(plan, l, c.vertex_count, c.edge_count, c.face_count);
+			level_end[l] = samples;
+		}
+		seam_bytes = size_t(counts[2]) * (sizeof(uint32_t) + (3 + 3 * mc_edge_samples(plan.R)) * sizeof(rgb));
+		header_ok = true;
+		return true;
+	}
+
+	//where sample n of the stream goes in the compact colors
+	rgb& target(size_t n)
+	{
+		unsigned int l = 0;
+		while (level_end[l] <= n) {
+			l++;
+		}
+		n -= l > 0 ? level_end[l - 1] : 0;
+		if (l == 0) {
+			if (n < c.vertex_count) return c.colors[n];
+			n -= c.vertex_count;
+		}
+		const std::vector<unsigned int>& em = plan.edge_m[l];
+		size_t en = size_t(c.edge_count) * em.size();
+		if (n < en) {
+			return c.colors[c.edge_slot(unsigned(n / em.size()), em[n % em.size()])];
+		}
+		n -= en;
+		const std::vector<unsigned int>& fs = plan.interior[l];
+		size_t f = n / fs.size();
+		return c.colors[c.table[2 * f].w + fs[n % fs.size()] - (3 + 3 * mc_edge_samples(plan.R))];
+	}
+
+	//puts stream samples [n0, n1) from data in place
+	void place(const unsigned char* data, size_t n0, size_t n1)
+	{
+		parallel_for(0, n1 - n0, [&](size_t n) {
+			std::memcpy(&target(n0 + n), data + n * sizeof(rgb), sizeof(rgb));
+		});
+	}
+
+	//fills faces [f0, f1) of out from the samples of the first `levels` levels
+	void fill_faces(mc_buffer& out, unsigned int f0, unsigned int f1, unsigned int levels)
+	{
+		if (f1 <= f0) {
+			return;
+		}
+		unsigned int R = plan.R;
+		unsigned int l = levels - 1;
+		unsigned int r = plan.res[l];
+		unsigned int spf = mc_face_samples(R);
+		parallel_blocks(f0, f1, worker_count(), [&](size_t b0, size_t b1, unsigned int) {
+			std::vector<rgb> coarse(mc_face_samples(r));
+			for (size_t fi = b0; fi < b1; fi++)
+			{
+				unsigned int f = (unsigned int)fi;
+				rgb* dst = out.face(f);
+				for (unsigned int s = 0; s < coarse.size(); s++)
+				{
+					glm::uvec3 g = mc_slot_grid(r, s);
+					glm::uvec3 p = coarse_point(g.x, g.y, r, R);
+					coarse[s] = c.colors[c.slot(f, p.x, p.y, p.z)];
+				}
+				for (unsigned int s = 0; s < spf; s++)
+				{
+					glm::uvec3 g = mc_slot_grid(R, s);
+					if (plan.slot_level[s] <= l) {
+						dst[s] = c.colors[c.slot(f, g.x, g.y, g.z)];
+						continue;
+					}
+					glm::vec3 v = mc_eval_patch(coarse.data(), r, glm::vec3(g) / float(R));
+					dst[s] = rgb(int(v.x + 0.5f), int(v.y + 0.5f), int(v.z + 0.5f));
+				}
+			}
+		});
+	}
+
+	const mesh_topology& topo;
+	std::vector<unsigned char> head;
+	uint32_t counts[4] = { 0, 0, 0, 0 };
+	bool header_ok = false;
+	bool failed = false;
+	progressive_plan plan;
+	//samples arrive straight into their place here
+	mc_compact c;
+	//stream samples in all, where each level ends and how many arrived
+	size_t samples = 0;
+	std::vector<size_t> level_end;
+	size_t received = 0;
+	unsigned char carry[sizeof(rgb)];
+	size_t carry_bytes = 0;
+	size_t seam_bytes = 0;
+	std::vector<unsigned char> seams;
+	//what out holds: all faces at shown_levels, the first shown_faces one level finer
+	unsigned int shown_levels = 0;
+	unsigned int shown_faces = 0;
+	bool seams_shown = false;
+};
+
+/* reads a progressive file in blocks of block bytes, calling on_block(reader) after each
+   so the caller can refine and show what is there */
+template<typename F>
+bool stream_mc_progressive(const char* path, mc_progressive_reader& reader, size_t block, F on_block)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> buf(std::max<size_t>(block, 1));
+	while (in)
+	{
+		in.read((char*)buf.data(), buf.size());
+		if (in.gcount() <= 0 || !reader.feed(buf.data(), size_t(in.gcount()))) {
+			break;
+		}
+		on_block(reader);
+	}
+	return reader.done();
+}
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mc_stream.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+/* Mesh colors sequences for animation.
+   Frames of baked lighting or wear mostly repeat the frame before them. The colors of a
+   frame are cut in chunks of chunk_samples; a keyframe stores every sample, any other
+   frame a bitmap of the chunks that changed and those chunks XORed with the frame before.
+   Playback applies them in place and marks only them dirty, the partial uploads of
+   mc_upload.h then send only those. A keyframe is written every key_interval frames, or
+   sooner when more than key_fraction of the chunks changed, seeking starts from the
+   keyframe at or before the frame asked for.
+   File: mc_file_header (count0 R, count1 faces), mc_sequence_counts, the frames, then the
+   offset of every frame. A frame is a byte, 1 for keyframes, then either the colors or the
+   bitmap and the changed chunks. */
+
+//sequence: count0 resolution R, count1 faces
+const char mc_sequence_magic[4] = { 'M', 'C', 'S', 'Q' };
+
+struct mc_sequence_config {
+	unsigned int key_interval = 30;
+	//a frame changing more than this fraction of the chunks becomes a keyframe
+	float key_fraction = 0.5f;
+	unsigned int chunk_samples = 1024;
+};
+
+//follows the file header
+struct mc_sequence_counts {
+	uint32_t frames;
+	uint32_t key_interval;
+	uint32_t chunk_samples;
+	uint32_t pad;
+	//byte offset of the frame table
+	uint64_t table;
+};
+
+namespace {
+	const unsigned char MC_SEQUENCE_DELTA = 0;
+	const unsigned char MC_SEQUENCE_KEY = 1;
+
+	//marks the samples of the set chunks of a bitmap dirty, neighbouring chunks as one range
+	void mark_chunks_dirty(const std::vector<unsigned char>& changed, size_t chunk, mc_buffer& out)
+	{
+		size_t total = out.colors.size();
+		size_t c = 0, chunks = changed.size();
+		while (c < chunks)
+		{
+			if (!changed[c]) {
+				c++;
+				continue;
+			}
+			size_t c1 = c + 1;
+			while (c1 < chunks && changed[c1]) {
+				c1++;
+			}
+			out.dirty.add(c * chunk, std::min(total, c1 * chunk));
+			c = c1;
+		}
+	}
+};
+
+/* Writes a sequence one frame at a time, the frame table goes at the end on close() */
+class mc_sequence_writer {
+public:
+	~mc_sequence_writer()
+	{
+		if (out.is_open()) close();
+	}
+
+	bool open(const char* path, unsigned int _R, unsigned int faces, const mc_sequence_config& _cfg = mc_sequence_config())
+	{
+		cfg = _cfg;
+		cfg.key_interval = std::max(1u, cfg.key_interval);
+		cfg.chunk_samples = std::max(1u, cfg.chunk_samples);
+		R = _R;
+		face_count = faces;
+		prev.clear();
+		offsets.clear();
+		keyframes = 0;
+		out.open(path, std::ios::binary);
+		if (!out) {
+			std::cout << "failed to open " << path << std::endl;
+			return false;
+		}
+		mc_file_header h;
+		make_header(h, mc_sequence_magic, R, face_count);
+		mc_sequence_counts n = {};
+		out.write((const char*)&h, sizeof(h));
+		out.write((const char*)&n, sizeof(n));
+		return bool(out);
+	}
+
+	//appends b as the next frame
+	bool add(const mc_buffer& b)
+	{
+		if (!out.is_open() || b.R != R || b.face_count != face_count) {
+			std::cout << "sequence frame does not match the sequence" << std::endl;
+			return false;
+		}
+		size_t total = b.colors.size();
+		size_t cs = cfg.chunk_samples;
+		size_t chunks = (total + cs - 1) / cs;
+		offsets.push_back(uint64_t(out.tellp()));
+
+		bool key = prev.empty() || (offsets.size() - 1) % cfg.key_interval == 0;
+		std::vector<unsigned int> changed(chunks + 1, 0);
+		if (!key)
+		{
+			parallel_for(0, chunks, [&](size_t c) {
+				size_t n = std::min(cs, total - c * cs);
+				changed[c] = std::memcmp(b.colors.data() + c * cs, prev.data() + c * cs, n * sizeof(rgb)) != 0;
+			});
+			size_t count = prefix_sum(changed);
+			key = count > cfg.key_fraction * chunks;
+			if (!key)
+			{
+				//bitmap, then the changed chunks XORed with the frame before, the last chunk may be short
+				std::vector<unsigned char> bitmap((chunks + 7) / 8, 0);
+				for (size_t c = 0; c < chunks; c++) {
+					if (changed[c + 1] != changed[c]) bitmap[c >> 3] |= 1 << (c & 7);
+				}
+				std::vector<rgb> delta(count * cs);
+				parallel_for(0, chunks, [&](size_t c) {
+					if (changed[c + 1] == changed[c]) {
+						return;
+					}
+					size_t n = std::min(cs, total - c * cs);
+					unsigned char* d = (unsigned char*)(delta.data() + changed[c] * cs);
+					const unsigned char* x = (const unsigned char*)(b.colors.data() + c * cs);
+					const unsigned char* y = (const unsigned char*)(prev.data() + c * cs);
+					for (size_t i = 0; i < n * sizeof(rgb); i++) {
+						d[i] = x[i] ^ y[i];
+					}
+				});
+				size_t bytes = count * cs;
+				if (count > 0 && changed[chunks - 1] != changed[chunks]) {
+					bytes -= cs - (total - (chunks - 1) * cs);
+				}
+				out.put(char(MC_SEQUENCE_DELTA));
+				out.write((const char*)bitmap.data(), bitmap.size());
+				out.write((const char*)delta.data(), bytes * sizeof(rgb));
+			}
+		}
+		if (key)
+		{
+			out.put(char(MC_SEQUENCE_KEY));
+			out.write((const char*)b.colors.data(), total * sizeof(rgb));
+			keyframes++;
+		}
+		prev = b.colors;
+		return bool(out);
+	}
+
+	//writes the frame table and the counts, the file is complete after this
+	bool close()
+	{
+		mc_sequence_counts n = {};
+		n.frames = (uint32_t)offsets.size();
+		n.key_interval = cfg.key_interval;
+		n.chunk_samples = cfg.chunk_samples;
+		n.table = uint64_t(out.tellp());
+		out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+		out.seekp(sizeof(mc_file_header));
+		out.write((const char*)&n, sizeof(n));
+		bool ok = bool(out);
+		out.close();
+		return ok;
+	}
+
+	unsigned int frames() const { return (unsigned int)offsets.size(); }
+	unsigned int keyframe_count() const { return keyframes; }
+
+private:
+	std::ofstream out;
+	mc_sequence_config cfg;
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	std::vector<rgb> prev;
+	std::vector<uint64_t> offsets;
+	unsigned int keyframes = 0;
+};
+
+/* Plays a sequence into an mc_buffer, marking dirty only the chunks each frame changes */
+class mc_sequence_player {
+public:
+	bool open(const char* path)
+	{
+		current = NO_FRAME;
+		if (!file.open(path, mapped_file::RANDOM)) {
+			return false;
+		}
+		mc_file_header h;
+		if (!check_header(file, mc_sequence_magic, path, h)) {
+			file.close();
+			return false;
+		}
+		if (file.size() < sizeof(h) + sizeof(counts)) {
+			std::cout << "truncated sequence: " << path << std::endl;
+			file.close();
+			return false;
+		}
+		if (h.count0 == 0 || h.count0 > mc_colors_max_R || h.count1 > 0xFFFFFFFFu) {
+			std::cout << "unexpected file format: " << path << std::endl;
+			file.close();
+			return false;
+		}
+		std::memcpy(&counts, file.data() + sizeof(h), sizeof(counts));
+		R = (unsigned int)h.count0;
+		face_count = (unsigned int)h.count1;
+		samples = size_t(face_count) * mc_face_samples(R);
+		if (counts.chunk_samples == 0 || counts.table > file.size() ||
+			(file.size() - counts.table) / sizeof(uint64_t) < counts.frames) {
+			std::cout << "truncated sequence: " << path << std::endl;
+			file.close();
+			return false;
+		}
+		chunks = (samples + counts.chunk_samples - 1) / counts.chunk_samples;
+		offsets.resize(counts.frames);
+		std::memcpy(offsets.data(), file.data() + counts.table, offsets.size() * sizeof(uint64_t));
+		for (uint64_t o : offsets) {
+			if (o < sizeof(h) + sizeof(counts) || o >= counts.table) {
+				std::cout << "damaged sequence: " << path << std::endl;
+				file.close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	unsigned int frame_count() const { return counts.frames; }
+	//true if the frames have the resolution and faces of b
+	bool matches(const mc_buffer& b) const { return b.R == R && b.face_count == face_count; }
+	//frame shown last, NO_FRAME before the first seek
+	unsigned int frame() const { return current; }
+
+	bool is_keyframe(unsigned int n) const { return n < offsets.size() && file.data()[offsets[n]] == MC_SEQUENCE_KEY; }
+
+	//keyframe at or before frame n
+	unsigned int keyframe_before(unsigned int n) const
+	{
+		n = std::min(n, frame_count() - 1);
+		while (n > 0 && !is_keyframe(n)) {
+			n--;
+		}
+		return n;
+	}
+
+	//first keyframe after frame n, or the first frame past the last keyframe
+	unsigned int keyframe_after(unsigned int n) const
+	{
+		for (unsigned int k = n + 1; k < frame_count(); k++) {
+			if (is_keyframe(k)) return k;
+		}
+		return 0;
+	}
+
+	/* shows frame n in out: from the current frame when it comes before n and no keyframe lies
+	   between them, from the keyframe at or before n otherwise */
+	bool seek(unsigned int n, mc_buffer& out)
+	{
+		if (n >= frame_count()) {
+			return false;
+		}
+		std::vector<unsigned char> changed(chunks, 0);
+		unsigned int k = keyframe_before(n);
+		bool fresh = out.R != R || out.face_count != face_count;
+		if (fresh) {
+			out.resize(R, face_count);
+		}
+		unsigned int from;
+		if (!fresh && current != NO_FRAME && current >= k && current <= n) {
+			from = current + 1;
+		}
+		else
+		{
+			if (!apply(k, out, changed)) {
+				return false;
+			}
+			from = k + 1;
+		}
+		for (unsigned int f = from; f <= n; f++) {
+			if (!apply(f, out, changed)) {
+				return false;
+			}
+		}
+		current = n;
+		if (fresh) {
+			out.mark_all_dirty();
+		}
+		else {
+			mark_chunks_dirty(changed, counts.chunk_samples, out);
+		}
+		return true;
+	}
+
+	//shows the frame after the current one, the first one after the last
+	bool next(mc_buffer& out)
+	{
+		unsigned int n = current == NO_FRAME || current + 1 >= frame_count() ? 0 : current + 1;
+		return seek(n, out);
+	}
+
+private:
+	//applies frame n on top of the frame before it in out, sets the chunks it changed
+	bool apply(unsigned int n, mc_buffer& out, std::vector<unsigned char>& changed)
+	{
+		size_t cs = counts.chunk_samples;
+		size_t end = n + 1 < offsets.size() ? offsets[n + 1] : counts.table;
+		const unsigned char* p = file.data() + offsets[n];
+		if (offsets[n] >= end || end > file.size()) {
+			std::cout << "damaged sequence frame " << n << std::endl;
+			return false;
+		}
+		size_t bytes = end - offsets[n] - 1;
+		if (*p++ == MC_SEQUENCE_KEY)
+		{
+			if (bytes < samples * sizeof(rgb)) {
+				std::cout << "damaged sequence frame " << n << std::endl;
+				return false;
+			}
+			//only the chunks that differ from what out holds count as changed
+			const rgb* src = (const rgb*)p;
+			parallel_for(0, chunks, [&](size_t c) {
+				size_t m = std::min(cs, samples - c * cs);
+				if (std::memcmp(out.colors.data() + c * cs, src + c * cs, m * sizeof(rgb)) != 0) {
+					std::memcpy(out.colors.data() + c * cs, src + c * cs, m * sizeof(rgb));
+					changed[c] = 1;
+				}
+			});
+			return true;
+		}
+		//where each changed chunk starts in the frame
+		size_t bitmap = (chunks + 7) / 8;
+		std::vector<unsigned int> start(chunks + 1, 0);
+		if (bytes < bitmap) {
+			std::cout << "damaged sequence frame " << n << std::endl;
+			return false;
+		}
+		for (size_t c = 0; c < chunks; c++) {
+			start[c] = (p[c >> 3] >> (c & 7)) & 1;
+		}
+		size_t count = prefix_sum(start);
+		size_t need = count * cs;
+		if (count > 0 && start[chunks] != start[chunks - 1]) {
+			need -= cs - (samples - (chunks - 1) * cs);
+		}
+		if (bytes - bitmap < need * sizeof(rgb)) {
+			std::cout << "damaged sequence frame " << n << std::endl;
+			return false;
+		}
+		const unsigned char* delta = p + bitmap;
+		parallel_for(0, chunks, [&](size_t c) {
+			if (start[c + 1] == start[c]) {
+				return;
+			}
+			size_t m = std::min(cs, samples - c * cs);
+			unsigned char* d = (unsigned char*)(out.colors.data() + c * cs);
+			const unsigned char* x = delta + size_t(start[c]) * cs * sizeof(rgb);
+			for (size_t i = 0; i < m * sizeof(rgb); i++) {
+				d[i] ^= x[i];
+			}
+			changed[c] = 1;
+		});
+		return true;
+	}
+
+	static const unsigned int NO_FRAME = 0xFFFFFFFFu;
+
+	mapped_file file;
+	mc_sequence_counts counts = {};
+	std::vector<uint64_t> offsets;
+	unsigned int R = 0;
+	unsigned int face_count = 0;
+	size_t samples = 0;
+	size_t chunks = 0;
+	unsigned int current = NO_FRAME;
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+/* Out of core mesh colors baking.
+   Geometry and source image are read from flat binary files through memory maps and
+   faces are baked in chunks whose size comes from a memory budget, every finished chunk
+   is appended to the output in the mc_buffer layout. Heap usage is one chunk of colors,
+   whatever the size of the mesh. */
+
+struct mc_file_header {
+	char magic[4];
+	unsigned int version;
+	uint64_t count0;
+	uint64_t count1;
+};
+
+//geometry: count0 vertices, count1 indices, followed by vertex[count0] and unsigned int[count1]
+const char mc_geometry_magic[4] = { 'M', 'C', 'G', 'M' };
+//image: count0 width, count1 height, followed by rgb[width*height] indexed as x*height + y
+const char mc_image_magic[4] = { 'M', 'C', 'I', 'M' };
+//colors: count0 resolution R, count1 faces, followed by the mc_buffer colors
+const char mc_colors_magic[4] = { 'M', 'C', 'C', 'L' };
+//largest R a colors file may hold, mesh_colors2 goes up to r = 8
+const unsigned int mc_colors_max_R = 255;
+
+struct mc_stream_config {
+	unsigned int R = 3;
+	//bytes of colors kept in memory at once
+	size_t memory_budget = size_t(256) << 20;
+};
+
+namespace {
+	void make_header(mc_file_header& h, const char* magic, uint64_t c0, uint64_t c1)
+	{
+		std::memcpy(h.magic, magic, 4);
+		h.version = 1;
+		h.count0 = c0;
+		h.count1 = c1;
+	}
+
+	bool check_header(const mapped_file& f, const char* magic, const char* path, mc_file_header& h)
+	{
+		if (f.size() < sizeof(mc_file_header)) {
+			std::cout << "file too small: " << path << std::endl;
+			return false;
+		}
+		std::memcpy(&h, f.data(), sizeof(h));
+		if (std::memcmp(h.magic, magic, 4) != 0 || h.version != 1) {
+			std::cout << "unexpected file format: " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+//dumps vertices and indices as a geometry file
+bool write_geometry_blob(const std::vector<vertex>& verts, const std::vector<unsigned int>& inds, const char* path)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	mc_file_header h;
+	make_header(h, mc_geometry_magic, verts.size(), inds.size());
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)verts.data(), verts.size() * sizeof(vertex));
+	out.write((const char*)inds.data(), inds.size() * sizeof(unsigned int));
+	return bool(out);
+}
+
+bool write_geometry_blob(const Model& m, const char* path)
+{
+	return write_geometry_blob(m.vertices, m.indices, path);
+}
+
+//reads a geometry file back into memory
+bool load_geometry_blob(const char* path, std::vector<vertex>& verts, std::vector<unsigned int>& inds)
+{
+	mapped_file in(path);
+	mc_file_header h;
+	if (!in.is_open() || !check_header(in, mc_geometry_magic, path, h)) {
+		return false;
+	}
+	if (in.size() < sizeof(h) + h.count0 * sizeof(vertex) + h.count1 * sizeof(unsigned int)) {
+		std::cout << "truncated geometry file: " << path << std::endl;
+		return false;
+	}
+	const vertex* v = (const vertex*)(in.data() + sizeof(h));
+	const unsigned int* i = (const unsigned int*)(v + h.count0);
+	verts.assign(v, v + h.count0);
+	inds.assign(i, i + h.count1);
+	return true;
+}
+
+//decodes an image once and stores it as a flat rgb image file
+bool write_image_blob(const char* image_file, const char* path)
+{
+	int w, h, c;
+	unsigned char* img = SOIL_load_image(image_file, &w, &h, &c, SOIL_LOAD_RGB);
+	if (img == NULL) {
+		std::cout << "failed to load image: " << SOIL_last_result() << std::endl;
+		return false;
+	}
+	std::ofstream out(path, std::ios::binary);
+	if (out) {
+		mc_file_header hd;
+		make_header(hd, mc_image_magic, w, h);
+		out.write((const char*)&hd, sizeof(hd));
+		out.write((const char*)img, size_t(w) * h * 3);
+	}
+	else {
+		std::cout << "failed to open " << path << std::endl;
+	}
+	SOIL_free_image_data(img);
+	return bool(out);
+}
+
+bool save_mc_buffer(const mc_buffer& b, const char* path)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	mc_file_header h;
+	make_header(h, mc_colors_magic, b.R, b.face_count);
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)b.colors.data(), b.colors.size() * sizeof(rgb));
+	return bool(out);
+}
+
+bool load_mc_buffer(const char* path, mc_buffer& b)
+{
+	mapped_file in(path);
+	mc_file_header h;
+	if (!in.is_open() || !check_header(in, mc_colors_magic, path, h)) {
+		return false;
+	}
+	//checked before anything is allocated, a damaged header would ask for any size
+	if (h.count0 == 0 || h.count0 > mc_colors_max_R || h.count1 > 0xFFFFFFFFu) {
+		std::cout << "unexpected file format: " << path << std::endl;
+		return false;
+	}
+	size_t samples = size_t(h.count1) * mc_face_samples((unsigned int)h.count0);
+	if ((in.size() - sizeof(h)) / sizeof(rgb) < samples) {
+		std::cout << "truncated colors file: " << path << std::endl;
+		return false;
+	}
+	b.resize((unsigned int)h.count0, (unsigned int)h.count1);
+	std::memcpy(b.colors.data(), in.data() + sizeof(h), b.colors.size() * sizeof(rgb));
+	return true;
+}
+
+//bakes mesh colors at resolution cfg.R straight from geometry and image files into a colors file
+bool stream_bake_mesh_colors(const char* geometry_path, const char* image_path, const char* out_path, const mc_stream_config& cfg)
+{
+	mapped_file geo(geometry_path, mapped_file::RANDOM);
+	mapped_file tex(image_path, mapped_file::RANDOM);
+	mc_file_header gh, th;
+	if (!geo.is_open() || !tex.is_open() ||
+		!check_header(geo, mc_geometry_magic, geometry_path, gh) ||
+		!check_header(tex, mc_image_magic, image_path, th)) {
+		return false;
+	}
+
+	size_t nv = gh.count0;
+	size_t ni = gh.count1;
+	unsigned int wid = (unsigned int)th.count0;
+	unsigned int hei = (unsigned int)th.count1;
+	if (geo.size() < sizeof(gh) + nv * sizeof(vertex) + ni * sizeof(unsigned int) ||
+		tex.size() < sizeof(th) + size_t(wid) * hei * sizeof(rgb) || wid == 0 || hei == 0) {
+		std::cout << "truncated geometry or image file" << std::endl;
+		return false;
+	}
+	const vertex* verts = (const vertex*)(geo.data() + sizeof(gh));
+	const unsigned int* inds = (const unsigned int*)(verts + nv);
+	const rgb* image = (const rgb*)(tex.data() + sizeof(th));
+
+	unsigned int R = cfg.R;
+	unsigned int spf = mc_face_samples(R);
+	size_t faces = ni / 3;
+	size_t chunk_faces = std::max<size_t>(1, cfg.memory_budget / (spf * sizeof(rgb)));
+	chunk_faces = std::min(chunk_faces, std::max<size_t>(faces, 1));
+
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = mc_slot_bary(R, s);
+	}
+
+	std::ofstream out(out_path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << out_path << std::endl;
+		return false;
+	}
+	mc_file_header oh;
+	make_header(oh, mc_colors_magic, R, faces);
+	out.write((const char*)&oh, sizeof(oh));
+
+	std::vector<rgb> chunk(chunk_faces * spf);
+	size_t bad_faces = 0;
+	for (size_t c0 = 0; c0 < faces; c0 += chunk_faces)
+	{
+		size_t c1 = std::min(faces, c0 + chunk_faces);
+		std::atomic<size_t> bad(0);
+		parallel_for(c0, c1, [&](size_t f) {
+			rgb* dst = chunk.data() + (f - c0) * spf;
+			unsigned int a = inds[3 * f + 0];
+			unsigned int b = inds[3 * f + 1];
+			unsigned int c = inds[3 * f + 2];
+			if (a >= nv || b >= nv || c >= nv) {
+				std::fill(dst, dst + spf, rgb(0, 0, 0));
+				bad++;
+				return;
+			}
+			for (unsigned int s = 0; s < spf; s++)
+			{
+				glm::vec2 uv = barycentric_to_cartesian(bary[s].x, bary[s].y, bary[s].z, verts[a].uv, verts[b].uv, verts[c].uv);
+				dst[s] = image[mc_texel(uv, wid, hei)];
+			}
+		});
+		bad_faces += bad;
+
+		out.write((const char*)chunk.data(), (c1 - c0) * spf * sizeof(rgb));
+		if (!out) {
+			std::cout << "failed writing " << out_path << std::endl;
+			return false;
+		}
+
+		//drop what this chunk paged in so the resident set stays near the budget
+		geo.release(sizeof(gh) + nv * sizeof(vertex) + c0 * 3 * sizeof(unsigned int), (c1 - c0) * 3 * sizeof(unsigned int));
+		geo.release(sizeof(gh), nv * sizeof(vertex));
+		tex.release(sizeof(th), size_t(wid) * hei * sizeof(rgb));
+		std::cout << "baked faces " << c1 << " / " << faces << std::endl;
+	}
+
+	if (bad_faces > 0) {
+		std::cout << bad_faces << " faces had out of range indices" << std::endl;
+	}
+	return true;
+}
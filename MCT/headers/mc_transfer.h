@@ -0,0 +1,85 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include "definitions.h"
+#include "mc_buffer.h"
+#include "bvh.h"
+#include "parallel.h"
+
+/* Mesh colors transfer between meshes of different topology.
+   Every sample of the target mesh takes the color of the closest point of the source mesh,
+   read from the source mesh colors with barycentric filtering. Samples of one face are close
+   to each other, so the distance to the previous sample's closest point bounds the search
+   of the next one and most of the bvh is culled right away. */
+
+struct transfer_config {
+	unsigned int R = 7;
+	//samples further than this from the source keep black, 0 means no limit
+	float max_distance = 0.0f;
+};
+
+/* Transfers src_colors, laid over the faces of the mesh src_tree was built on, to the
+   target faces. Returns the number of samples left without a source point. */
+size_t transfer_mesh_colors(const bvh& src_tree, const mc_buffer& src_colors,
+	const std::vector<vertex>& dst_verts, const std::vector<unsigned int>& dst_inds,
+	mc_buffer& out, const transfer_config& cfg)
+{
+	unsigned int faces = (unsigned int)(dst_inds.size() / 3);
+	out.resize(cfg.R, faces);
+	if (faces == 0) {
+		return 0;
+	}
+	if (src_tree.nodes.empty() || src_colors.face_count < src_tree.face_count()) {
+		std::cout << "transfer source has no mesh colors" << std::endl;
+		return out.colors.size();
+	}
+
+	unsigned int spf = mc_face_samples(cfg.R);
+	std::vector<glm::vec3> bary(spf);
+	for (unsigned int s = 0; s < spf; s++) {
+		bary[s] = glm::vec3(mc_slot_grid(cfg.R, s)) / float(cfg.R > 0 ? cfg.R : 1);
+	}
+	float limit2 = cfg.max_distance > 0.0f ? cfg.max_distance * cfg.max_distance : FLT_MAX;
+
+	std::atomic<size_t> misses(0);
+	parallel_for(0, faces, [&](size_t fi) {
+		unsigned int f = (unsigned int)fi;
+		const vertex& a = dst_verts[dst_inds[3 * f + 0]];
+		const vertex& b = dst_verts[dst_inds[3 * f + 1]];
+		const vertex& c = dst_verts[dst_inds[3 * f + 2]];
+		rgb* dst = out.face(f);
+		size_t missed = 0;
+		bool have_prev = false;
+		glm::vec3 prev;
+		for (unsigned int s = 0; s < spf; s++)
+		{
+			glm::vec3 p = a.pos * bary[s].x + b.pos * bary[s].y + c.pos * bary[s].z;
+			point_hit hit;
+			hit.d2 = limit2;
+			if (have_prev) {
+				//the previous closest point is a candidate, nothing further can win
+				float d = glm::length(p - prev) * 1.0001f + 1e-7f;
+				hit.d2 = std::min(limit2, d * d);
+			}
+			if (!src_tree.closest_point(p, hit)) {
+				dst[s] = rgb(0, 0, 0);
+				missed++;
+				have_prev = false;
+				continue;
+			}
+			glm::vec3 pa, pb, pc;
+			src_tree.corners(hit.face, pa, pb, pc);
+			prev = pa + (pb - pa) * hit.u + (pc - pa) * hit.v;
+			have_prev = true;
+
+			glm::vec3 col = mc_eval(src_colors, hit.face, glm::vec3(1.0f - hit.u - hit.v, hit.u, hit.v)) + 0.5f;
+			dst[s] = rgb(int(col.x), int(col.y), int(col.z));
+		}
+		misses += missed;
+	});
+	out.mark_all_dirty();
+	return misses.load();
+}
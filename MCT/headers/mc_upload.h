@@ -0,0 +1,182 @@
+#pragma once
+
+#include <gl/glew.h>
+#include <vector>
+#include <algorithm>
+#include "gl_macro.h"
+#include "definitions.h"
+#include "mc_buffer.h"
+
+/* Partial re-upload of edited mesh colors.
+   Edits mark sample ranges dirty in the mc_buffer, once per frame the ranges are merged
+   and only those are sent to the gpu, either as buffer sub data (one rgba8 texel per
+   sample, read through a samplerBuffer) or as sub images of the rect2D the mesh colors
+   were scattered to. */
+
+//nearby ranges closer than this many samples are sent in one call
+const size_t mc_upload_gap = 64;
+
+/* Mesh colors as a texture buffer, one rgba8 texel per sample */
+class mc_gpu_buffer {
+public:
+	~mc_gpu_buffer()
+	{
+		if (texture) glDeleteTextures(1, &texture);
+		if (buffer) glDeleteBuffers(1, &buffer);
+	}
+
+	//full upload, (re)allocates the buffer when the sample count changes
+	void upload(mc_buffer& b)
+	{
+		b.dirty.clear();
+		upload(b.colors.data(), b.colors.size());
+	}
+
+	//full upload of count samples from colors
+	void upload(const rgb* colors, size_t count)
+	{
+		if (buffer == 0) {
+			GLCall(glGenBuffers(1, &buffer));
+			GLCall(glGenTextures(1, &texture));
+		}
+		fill_staging(colors, 0, count);
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, buffer));
+		if (samples != count) {
+			samples = count;
+			GLCall(glBufferData(GL_TEXTURE_BUFFER, samples * 4, staging.data(), GL_DYNAMIC_DRAW));
+			GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+			GLCall(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, buffer));
+		}
+		else {
+			GLCall(glBufferSubData(GL_TEXTURE_BUFFER, 0, samples * 4, staging.data()));
+		}
+	}
+
+	//sends the given sample ranges
+	void update(const mc_buffer& b, const std::vector<sample_range>& ranges)
+	{
+		if (ranges.empty()) {
+			return;
+		}
+		GLCall(glBindBuffer(GL_TEXTURE_BUFFER, buffer));
+		for (const auto& r : ranges)
+		{
+			fill_staging(b.colors.data(), r.begin, r.end);
+			GLCall(glBufferSubData(GL_TEXTURE_BUFFER, r.begin * 4, (r.end - r.begin) * 4, staging.data()));
+		}
+	}
+
+	//uploads whatever was edited since the last call
+	void flush(mc_buffer& b)
+	{
+		if (samples != b.colors.size()) {
+			upload(b);
+			return;
+		}
+		if (!b.dirty.empty()) {
+			update(b, b.dirty.take(mc_upload_gap));
+		}
+	}
+
+	void bind(unsigned int unit)
+	{
+		GLCall(glActiveTexture(GL_TEXTURE0 + unit));
+		GLCall(glBindTexture(GL_TEXTURE_BUFFER, texture));
+	}
+
+	GLuint buffer = 0;
+	GLuint texture = 0;
+
+private:
+	void fill_staging(const rgb* colors, size_t begin, size_t end)
+	{
+		staging.resize((end - begin) * 4);
+		for (size_t i = begin; i < end; i++)
+		{
+			unsigned char* t = &staging[(i - begin) * 4];
+			t[0] = colors[i].r;
+			t[1] = colors[i].g;
+			t[2] = colors[i].b;
+			t[3] = 0xFF;
+		}
+	}
+
+	size_t samples = 0;
+	std::vector<unsigned char> staging;
+};
+
+/* Keeps the rect2D texture built by custom_mesh_color_texture in sync with an mc_buffer.
+   Dirty samples are scattered to their texels and the touched texels are grouped in row
+   bands, each band is one glTexSubImage2D call. */
+class mc_texture_proxy {
+public:
+	mc_texture_proxy(const mesh_colors2& m, rect2D& r, GLuint id) : image(r), tex(id)
+	{
+		unsigned int R = m.faces.empty() ? 0 : m.faces[0].R;
+		unsigned int spf = mc_face_samples(R);
+		texels.resize(m.faces.size() * spf);
+		for (size_t f = 0; f < m.faces.size(); f++) {
+			for (unsigned int s = 0; s < spf; s++) {
+				texels[f * spf + s] = mc_face_texel(m.faces[f], s);
+			}
+		}
+	}
+
+	//writes the given sample ranges to the image and re-uploads the texels they cover
+	void update(const mc_buffer& b, const std::vector<sample_range>& ranges)
+	{
+		touched.clear();
+		for (const auto& r : ranges) {
+			for (size_t i = r.begin; i < r.end; i++) {
+				image.insert_1D(texels[i], b.colors[i]);
+				touched.push_back(texels[i]);
+			}
+		}
+		if (touched.empty()) {
+			return;
+		}
+		std::sort(touched.begin(), touched.end());
+
+		//row spans of the touched texels, rows follow the gl upload order of rect2D::data
+		unsigned int wid = image.wid;
+		unsigned int band_y0 = touched[0] / wid, band_y1 = band_y0;
+		unsigned int band_x0 = touched[0] % wid, band_x1 = band_x0;
+		for (size_t i = 1; i <= touched.size(); i++)
+		{
+			if (i < touched.size())
+			{
+				unsigned int y = touched[i] / wid;
+				unsigned int x = touched[i] % wid;
+				//grow the band while rows are consecutive and spans stay close
+				if (y == band_y1 || (y == band_y1 + 1 && x + mc_upload_gap >= band_x0 && x <= band_x1 + mc_upload_gap)) {
+					band_y1 = y;
+					band_x0 = std::min(band_x0, x);
+					band_x1 = std::max(band_x1, x);
+					continue;
+				}
+				update_rectangle_texture(image, tex, band_x0, band_y0, band_x1 - band_x0 + 1, band_y1 - band_y0 + 1);
+				band_y0 = band_y1 = y;
+				band_x0 = band_x1 = x;
+			}
+			else {
+				update_rectangle_texture(image, tex, band_x0, band_y0, band_x1 - band_x0 + 1, band_y1 - band_y0 + 1);
+			}
+		}
+	}
+
+	//uploads whatever was edited since the last call
+	void flush(mc_buffer& b)
+	{
+		if (!b.dirty.empty()) {
+			update(b, b.dirty.take(mc_upload_gap));
+		}
+	}
+
+	//texel of every mc_buffer sample
+	std::vector<unsigned int> texels;
+
+private:
+	rect2D& image;
+	GLuint tex;
+	std::vector<unsigned int> touched;
+};
@@ -8,6 +8,7 @@
 //#define SHOW_MSG 1
 
 unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma);
+bool load_mesh_geometry(const char *path, std::vector<vertex>& vertices, std::vector<unsigned int>& indices);
 
 enum class l_mode {
 	SPLIT,
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+/* Minimal fork-join helpers used by the cpu side of the mesh colors pipeline */
+
+//number of worker threads, never zero, inline as more than one translation unit includes this
+inline unsigned int worker_count()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : n;
+}
+
+//splits [begin, end) in one contiguous block per worker and calls fn(block_begin, block_end, block)
+//blocks are deterministic for a given range and worker count, so callers can keep per block results
+//and combine them afterwards in block order
+template<typename F>
+void parallel_blocks(size_t begin, size_t end, unsigned int blocks, F fn)
+{
+	if (end <= begin) {
+		return;
+	}
+	size_t n = end - begin;
+	blocks = (unsigned int)std::max<size_t>(1, std::min<size_t>(blocks, n));
+	if (blocks == 1) {
+		fn(begin, end, 0u);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(blocks - 1);
+	size_t step = (n + blocks - 1) / blocks;
+	for (unsigned int b = 1; b < blocks; b++)
+	{
+		size_t b0 = std::min(end, begin + b * step);
+		size_t b1 = std::min(end, b0 + step);
+		threads.emplace_back([=]() { fn(b0, b1, b); });
+	}
+	fn(begin, std::min(end, begin + step), 0u);
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+//calls fn(i) for every i in [begin, end), spread over all workers
+template<typename F>
+void parallel_for(size_t begin, size_t end, F fn)
+{
+	//small ranges are not worth the thread start up
+	unsigned int blocks = (end - begin) < 4096 ? 1 : worker_count();
+	parallel_blocks(begin, end, blocks, [&fn](size_t b0, size_t b1, unsigned int) {
+		for (size_t i = b0; i < b1; i++) {
+			fn(i);
+		}
+	});
+}
+
+//exclusive prefix sum in place, returns the total
+template<typename T>
+T prefix_sum(std::vector<T>& v)
+{
+	T sum = 0;
+	for (size_t i = 0; i < v.size(); i++)
+	{
+		T c = v[i];
+		v[i] = sum;
+		sum += c;
+	}
+	return sum;
+}
+
+//counting sort of the items [0, n) in num_keys buckets, key(i) must be < num_keys
+//on return bucket k holds items[offsets[k] .. offsets[k+1]) in increasing item order
+template<typename K>
+void parallel_bucket(size_t n, size_t num_keys, K key, std::vector<unsigned int>& offsets, std::vector<unsigned int>& items)
+{
+	std::vector<std::atomic<unsigned int>> cursor(num_keys);
+	parallel_for(0, num_keys, [&](size_t k) { cursor[k].store(0, std::memory_order_relaxed); });
+	parallel_for(0, n, [&](size_t i) { cursor[key(i)].fetch_add(1, std::memory_order_relaxed); });
+
+	offsets.resize(num_keys + 1);
+	for (size_t k = 0; k < num_keys; k++) {
+		offsets[k] = cursor[k].load(std::memory_order_relaxed);
+	}
+	offsets[num_keys] = 0;
+	prefix_sum(offsets);
+
+	parallel_for(0, num_keys, [&](size_t k) { cursor[k].store(offsets[k], std::memory_order_relaxed); });
+	items.resize(n);
+	parallel_for(0, n, [&](size_t i) {
+		items[cursor[key(i)].fetch_add(1, std::memory_order_relaxed)] = (unsigned int)i;
+	});
+
+	//scatter order depends on thread timing, buckets are small so sorting them back is cheap
+	parallel_for(0, num_keys, [&](size_t k) {
+		std::sort(items.begin() + offsets[k], items.begin() + offsets[k + 1]);
+	});
+}
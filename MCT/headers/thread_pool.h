@@ -0,0 +1,152 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "parallel.h"
+
+/* Work stealing thread pool.
+   Each worker owns a task queue, it pops its own newest tasks and when empty steals the
+   oldest ones from the other queues, so uneven work (rays that hit a lot of geometry next
+   to rays that leave the scene) still keeps every core busy. The calling thread helps
+   until its tasks are done, so a pool is never waited on idle. */
+class thread_pool {
+public:
+	explicit thread_pool(unsigned int threads = worker_count() - 1)
+	{
+		unsigned int n = std::max(1u, threads);
+		for (unsigned int i = 0; i < n; i++) {
+			queues.emplace_back(new task_queue());
+		}
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back([this, i]() { worker(i); });
+		}
+	}
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lk(wake_mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto& t : workers) {
+			t.join();
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	//calls fn(i) for i in [begin, end), grain consecutive items per task, returns once all ran
+	template<typename F>
+	void parallel_for(size_t begin, size_t end, size_t grain, F fn)
+	{
+		if (end <= begin) {
+			return;
+		}
+		grain = std::max<size_t>(1, grain);
+		size_t tasks = (end - begin + grain - 1) / grain;
+		std::atomic<size_t> remaining(tasks);
+		for (size_t t = 0; t < tasks; t++)
+		{
+			size_t b0 = begin + t * grain;
+			size_t b1 = std::min(end, b0 + grain);
+			push((unsigned int)(t % queues.size()), [&fn, &remaining, b0, b1]() {
+				for (size_t i = b0; i < b1; i++) {
+					fn(i);
+				}
+				remaining--;
+			});
+		}
+		{
+			std::lock_guard<std::mutex> lk(wake_mutex);
+		}
+		wake.notify_all();
+
+		while (remaining.load() > 0) {
+			if (!run_one((unsigned int)queues.size())) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	//workers plus the calling thread
+	unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+private:
+	struct task_queue {
+		std::mutex m;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void push(unsigned int q, std::function<void()> t)
+	{
+		std::lock_guard<std::mutex> lk(queues[q]->m);
+		queues[q]->tasks.push_back(std::move(t));
+		queued++;
+	}
+
+	//own queue from the back, others from the front; self out of range means steal only
+	bool run_one(unsigned int self)
+	{
+		std::function<void()> t;
+		if (self < queues.size())
+		{
+			std::lock_guard<std::mutex> lk(queues[self]->m);
+			if (!queues[self]->tasks.empty()) {
+				t = std::move(queues[self]->tasks.back());
+				queues[self]->tasks.pop_back();
+			}
+		}
+		for (size_t k = 1; !t && k <= queues.size(); k++)
+		{
+			task_queue& q = *queues[(self + k) % queues.size()];
+			std::lock_guard<std::mutex> lk(q.m);
+			if (!q.tasks.empty()) {
+				t = std::move(q.tasks.front());
+				q.tasks.pop_front();
+			}
+		}
+		if (!t) {
+			return false;
+		}
+		queued--;
+		t();
+		return true;
+	}
+
+	void worker(unsigned int id)
+	{
+		while (true)
+		{
+			if (run_one(id)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lk(wake_mutex);
+			wake.wait(lk, [this]() { return stop || queued.load() > 0; });
+			if (stop && queued.load() == 0) {
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<task_queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued{ 0 };
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	bool stop = false;
+};
+
+//pool shared by the bake stages
+thread_pool& default_pool()
+{
+	static thread_pool pool;
+	return pool;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <GLM/glm.hpp>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include "model.h"
+#include "parallel.h"
+
+/* Mesh connectivity for mesh colors.
+   Assimp splits vertices along uv seams, so the render index buffer does not know which
+   faces are neighbours. Vertices are welded by quantized position and the welded faces are
+   stored as an implicit half-edge structure: half-edge h = 3*face + k starts at corner k
+   of the face and goes to corner (k+1)%3, so only origin, twin and edge id are stored. */
+
+#define NO_HALF_EDGE 0xFFFFFFFFu
+
+struct mesh_topology {
+	//render vertex -> welded vertex
+	std::vector<unsigned int> weld;
+	//welded vertex -> render vertices, csr: weld_render[weld_offsets[w] .. weld_offsets[w+1])
+	std::vector<unsigned int> weld_offsets;
+	std::vector<unsigned int> weld_render;
+	//welded vertex positions
+	std::vector<glm::vec3> positions;
+
+	//per half-edge origin (welded), opposite half-edge and undirected edge id
+	std::vector<unsigned int> origin;
+	std::vector<unsigned int> twin;
+	std::vector<unsigned int> edge;
+	//one outgoing half-edge per welded vertex
+	std::vector<unsigned int> vertex_half_edge;
+	//one half-edge per undirected edge
+	std::vector<unsigned int> edge_half_edge;
+
+	unsigned int face_count() const { return (unsigned int)(origin.size() / 3); }
+	unsigned int vertex_count() const { return (unsigned int)positions.size(); }
+	unsigned int edge_count() const { return (unsigned int)edge_half_edge.size(); }
+
+	static unsigned int face_of(unsigned int h) { return h / 3; }
+	static unsigned int next(unsigned int h) { return (h % 3) == 2 ? h - 2 : h + 1; }
+	static unsigned int prev(unsigned int h) { return (h % 3) == 0 ? h + 2 : h - 1; }
+	unsigned int dest(unsigned int h) const { return origin[next(h)]; }
+	bool is_boundary(unsigned int h) const { return twin[h] == NO_HALF_EDGE; }
+
+	//face across half-edge h, NO_HALF_EDGE on the boundary
+	unsigned int neighbour(unsigned int h) const {
+		return is_boundary(h) ? NO_HALF_EDGE : face_of(twin[h]);
+	}
+};
+
+namespace {
+	//weld keys pack 21 bits per axis
+	const float weld_cells = float((1 << 21) - 1);
+
+	uint64_t weld_key(const glm::vec3& p, const glm::vec3& bmin, float inv_cell)
+	{
+		glm::vec3 q = (p - bmin) * inv_cell + 0.5f;
+		uint64_t x = (uint64_t)std::min(q.x, weld_cells);
+		uint64_t y = (uint64_t)std::min(q.y, weld_cells);
+		uint64_t z = (uint64_t)std::min(q.z, weld_cells);
+		return x | (y << 21) | (z << 42);
+	}
+
+	uint64_t weld_hash(uint64_t k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+};
+
+//welds render vertices closer than eps (relative to the bounding box diagonal) into topo.weld,
+//topo.weld_offsets, topo.weld_render and topo.positions
+void weld_vertices(const std::vector<vertex>& verts, mesh_topology& topo, float eps = 1e-6f)
+{
+	size_t n = verts.size();
+	topo.weld.assign(n, 0);
+	topo.positions.clear();
+	if (n == 0) {
+		topo.weld_offsets.assign(1, 0);
+		topo.weld_render.clear();
+		return;
+	}
+
+	//bounding box, one partial box per block
+	unsigned int blocks = worker_count();
+	std::vector<glm::vec3> bmin(blocks, verts[0].pos), bmax(blocks, verts[0].pos);
+	parallel_blocks(0, n, blocks, [&](size_t b0, size_t b1, unsigned int b) {
+		for (size_t i = b0; i < b1; i++) {
+			bmin[b] = glm::min(bmin[b], verts[i].pos);
+			bmax[b] = glm::max(bmax[b], verts[i].pos);
+		}
+	});
+	for (unsigned int b = 1; b < blocks; b++) {
+		bmin[0] = glm::min(bmin[0], bmin[b]);
+		bmax[0] = glm::max(bmax[0], bmax[b]);
+	}
+
+	//cell size is clamped so every key fits in 21 bits per axis
+	glm::vec3 ext = bmax[0] - bmin[0];
+	float cell = std::max(eps * glm::length(ext), std::max(ext.x, std::max(ext.y, ext.z)) / weld_cells);
+	float inv_cell = cell > 0.0f ? 1.0f / cell : 0.0f;
+
+	std::vector<uint64_t> keys(n);
+	parallel_for(0, n, [&](size_t i) { keys[i] = weld_key(verts[i].pos, bmin[0], inv_cell); });
+
+	//open addressing spatial hash, every cell ends up holding its lowest vertex index
+	size_t cap = 1;
+	while (cap < 2 * n) {
+		cap <<= 1;
+	}
+	size_t mask = cap - 1;
+	const unsigned int empty = 0xFFFFFFFFu;
+	std::vector<std::atomic<unsigned int>> table(cap);
+	parallel_for(0, cap, [&](size_t s) { table[s].store(empty, std::memory_order_relaxed); });
+
+	parallel_for(0, n, [&](size_t i) {
+		unsigned int v = (unsigned int)i;
+		size_t s = weld_hash(keys[i]) & mask;
+		while (true)
+		{
+			unsigned int cur = table[s].load();
+			if (cur == empty) {
+				if (table[s].compare_exchange_weak(cur, v)) {
+					return;
+				}
+				continue;
+			}
+			if (keys[cur] == keys[i]) {
+				while (v < cur && !table[s].compare_exchange_weak(cur, v));
+				return;
+			}
+			s = (s + 1) & mask;
+		}
+	});
+
+	//representative of each vertex, then dense ids in representative order
+	std::vector<unsigned int> rep(n);
+	parallel_for(0, n, [&](size_t i) {
+		size_t s = weld_hash(keys[i]) & mask;
+		while (keys[table[s].load(std::memory_order_relaxed)] != keys[i]) {
+			s = (s + 1) & mask;
+		}
+		rep[i] = table[s].load(std::memory_order_relaxed);
+	});
+
+	std::vector<unsigned int> block_count(blocks, 0);
+	parallel_blocks(0, n, blocks, [&](size_t b0, size_t b1, unsigned int b) {
+		for (size_t i = b0; i < b1; i++) {
+			block_count[b] += rep[i] == i;
+		}
+	});
+	unsigned int welded = prefix_sum(block_count);
+	parallel_blocks(0, n, blocks, [&](size_t b0, size_t b1, unsigned int b) {
+		unsigned int id = block_count[b];
+		for (size_t i = b0; i < b1; i++) {
+			if (rep[i] == i) {
+				topo.weld[i] = id++;
+			}
+		}
+	});
+
+	topo.positions.resize(welded);
+	parallel_for(0, n, [&](size_t i) {
+		if (rep[i] == i) {
+			topo.positions[topo.weld[i]] = verts[i].pos;
+		}
+	});
+	parallel_for(0, n, [&](size_t i) {
+		if (rep[i] != i) {
+			topo.weld[i] = topo.weld[rep[i]];
+		}
+	});
+
+	parallel_bucket(n, welded, [&](size_t i) { return topo.weld[i]; }, topo.weld_offsets, topo.weld_render);
+}
+
+//builds the half-edge tables over the welded vertices, edges shared by more than two faces
+//keep their first pair of opposite half-edges as twins and the rest as boundary
+void build_half_edges(const std::vector<unsigned int>& indices, mesh_topology& topo)
+{
+	size_t nh = indices.size() - (indices.size() % 3);
+	unsigned int nv = topo.vertex_count();
+
+	topo.origin.resize(nh);
+	topo.twin.assign(nh, NO_HALF_EDGE);
+	topo.edge.assign(nh, 0);
+	parallel_for(0, nh, [&](size_t h) { topo.origin[h] = topo.weld[indices[h]]; });
+
+	//half-edges bucketed by their lowest endpoint
+	std::vector<unsigned int> offsets, items;
+	parallel_bucket(nh, nv, [&](size_t h) {
+		return std::min(topo.origin[h], topo.dest((unsigned int)h));
+	}, offsets, items);
+
+	auto other = [&](unsigned int h) { return std::max(topo.origin[h], topo.dest(h)); };
+
+	//group each bucket by the other endpoint and count the undirected edges
+	std::vector<unsigned int> edge_offsets(nv + 1, 0);
+	parallel_for(0, nv, [&](size_t v) {
+		auto b0 = items.begin() + offsets[v];
+		auto b1 = items.begin() + offsets[v + 1];
+		std::stable_sort(b0, b1, [&](unsigned int x, unsigned int y) { return other(x) < other(y); });
+		unsigned int count = 0;
+		for (auto it = b0; it != b1; it++) {
+			count += (it == b0 || other(*it) != other(*(it - 1)));
+		}
+		edge_offsets[v] = count;
+	});
+	unsigned int ne = prefix_sum(edge_offsets);
+	topo.edge_half_edge.resize(ne);
+
+	parallel_for(0, nv, [&](size_t v) {
+		unsigned int id = edge_offsets[v];
+		unsigned int g0 = offsets[v];
+		while (g0 < offsets[v + 1])
+		{
+			unsigned int g1 = g0 + 1;
+			while (g1 < offsets[v + 1] && other(items[g1]) == other(items[g0])) {
+				g1++;
+			}
+
+			topo.edge_half_edge[id] = items[g0];
+			for (unsigned int i = g0; i < g1; i++)
+			{
+				unsigned int h = items[i];
+				topo.edge[h] = id;
+				if (topo.twin[h] != NO_HALF_EDGE) {
+					continue;
+				}
+				for (unsigned int j = i + 1; j < g1; j++)
+				{
+					unsigned int t = items[j];
+					if (topo.twin[t] == NO_HALF_EDGE && topo.origin[t] == topo.dest(h)) {
+						topo.twin[h] = t;
+						topo.twin[t] = h;
+						break;
+					}
+				}
+			}
+			id++;
+			g0 = g1;
+		}
+	});
+
+	//lowest outgoing half-edge of each vertex
+	std::vector<std::atomic<unsigned int>> first(nv);
+	parallel_for(0, nv, [&](size_t v) { first[v].store(NO_HALF_EDGE, std::memory_order_relaxed); });
+	parallel_for(0, nh, [&](size_t h) {
+		std::atomic<unsigned int>& f = first[topo.origin[h]];
+		unsigned int cur = f.load(std::memory_order_relaxed);
+		while (h < cur && !f.compare_exchange_weak(cur, (unsigned int)h));
+	});
+	topo.vertex_half_edge.resize(nv);
+	parallel_for(0, nv, [&](size_t v) { topo.vertex_half_edge[v] = first[v].load(std::memory_order_relaxed); });
+}
+
+//welds a model and builds its connectivity, runs in linear time over all cores
+void build_topology(const Model& m, mesh_topology& topo, float eps = 1e-6f)
+{
+	weld_vertices(m.vertices, topo, eps);
+	build_half_edges(m.indices, topo);
+}
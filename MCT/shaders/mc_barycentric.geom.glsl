@@ -0,0 +1,31 @@
+#version 430
+
+//passes the triangle through with the barycentric weights of its corners
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vPos[];
+in vec2 vTex[];
+in vec3 vNormal[];
+
+out vec3 gPos;
+out vec2 gTex;
+out vec3 gNormal;
+out vec3 gBary;
+
+void main()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		gl_Position = gl_in[i].gl_Position;
+		gl_PrimitiveID = gl_PrimitiveIDIn;
+		gPos = vPos[i];
+		gTex = vTex[i];
+		gNormal = vNormal[i];
+		gBary = vec3(0.0f);
+		gBary[i] = 1.0f;
+		EmitVertex();
+	}
+	EndPrimitive();
+}
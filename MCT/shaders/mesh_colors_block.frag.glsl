@@ -0,0 +1,62 @@
+#version 430
+
+in vec3 gPos;
+in vec2 gTex;
+in vec3 gNormal;
+in vec3 gBary;
+
+out vec4 color;
+
+#define MC_BLOCK_SAMPLES 16
+
+//block compressed mesh colors, endpoints then indices, blocks_per_face blocks per face
+layout(binding = 2) uniform usamplerBuffer mc_blocks;
+uniform int mc_R;
+uniform int mc_blocks_per_face;
+
+//same walk as mc_block_position in mc_block.h
+int block_position(int R, int i, int j)
+{
+	int start = i * (R + 1) - (i * (i - 1)) / 2;
+	return start + (((i & 1) != 0) ? R - i - j : j);
+}
+
+ivec3 endpoint(uint c)
+{
+	uint r = c >> 11, g = (c >> 5) & 63u, b = c & 31u;
+	return ivec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+//same integer math as mc_block_color
+vec3 fetch(int i, int j)
+{
+	int p = block_position(mc_R, i, j);
+	uvec2 b = texelFetch(mc_blocks, gl_PrimitiveID * mc_blocks_per_face + p / MC_BLOCK_SAMPLES).rg;
+	int k = int((b.y >> (2 * (p % MC_BLOCK_SAMPLES))) & 3u);
+	ivec3 c = (endpoint(b.x & 0xFFFFu) * (3 - k) + endpoint(b.x >> 16) * k + 1) / 3;
+	return vec3(c) / 255.0f;
+}
+
+void main()
+{
+	//linear between the three nearest samples, same as mc_eval_patch
+	int R = mc_R;
+	vec3 w = max(gBary, vec3(0.0f));
+	w /= (w.x + w.y + w.z);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = min(int(x), R - 1);
+	int j = min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	vec3 c;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = min(fx, 1.0f);
+		fy = min(fy, 1.0f - fx);
+		c = fetch(i, j) * (1.0f - fx - fy) + fetch(i + 1, j) * fx + fetch(i, j + 1) * fy;
+	}
+	else {
+		c = fetch(i + 1, j + 1) * (fx + fy - 1.0f) + fetch(i, j + 1) * (1.0f - fx) + fetch(i + 1, j) * (1.0f - fy);
+	}
+	color = vec4(c, 1.0f);
+}
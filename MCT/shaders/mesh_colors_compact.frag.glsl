@@ -0,0 +1,81 @@
+#version 430
+
+in vec3 gPos;
+in vec2 gTex;
+in vec3 gNormal;
+in vec3 gBary;
+
+out vec4 color;
+
+#define MC_EDGE_REVERSED 0x80000000u
+#define MC_CONSTANT 0x40000000u
+#define MC_OFFSET_MASK 0x3FFFFFFFu
+
+//compact mesh colors: vertex samples, edge samples, then face interiors
+layout(binding = 2) uniform samplerBuffer mesh_colors;
+//two texels per face: welded vertices and interior offset, then edge offsets
+layout(binding = 3) uniform usamplerBuffer mc_faces;
+uniform int mc_R;
+
+uvec4 face_vertices;
+uvec4 face_edges;
+
+//same addressing as mc_compact::slot in mc_compact.h
+int compact_slot(int i, int j, int k)
+{
+	int R = mc_R;
+	if (i == R) return int(face_vertices.x);
+	if (j == R) return int(face_vertices.y);
+	if (k == R) return int(face_vertices.z);
+	uint e;
+	int m;
+	if (k == 0) { e = face_edges.x; m = j; }
+	else if (i == 0) { e = face_edges.y; m = k; }
+	else if (j == 0) { e = face_edges.z; m = i; }
+	else {
+		if ((face_vertices.w & MC_CONSTANT) != 0u) {
+			return int(face_vertices.w & MC_OFFSET_MASK);
+		}
+		int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+		return int(face_vertices.w) + row + (j - 1);
+	}
+	if ((e & MC_CONSTANT) != 0u) {
+		return int(e & MC_OFFSET_MASK);
+	}
+	if ((e & MC_EDGE_REVERSED) != 0u) {
+		m = R - m;
+	}
+	return int(e & MC_OFFSET_MASK) + (m - 1);
+}
+
+vec3 fetch(int i, int j)
+{
+	return texelFetch(mesh_colors, compact_slot(i, j, mc_R - i - j)).rgb;
+}
+
+void main()
+{
+	face_vertices = texelFetch(mc_faces, 2 * gl_PrimitiveID);
+	face_edges = texelFetch(mc_faces, 2 * gl_PrimitiveID + 1);
+
+	//linear between the three nearest samples, same as mc_eval_patch
+	int R = mc_R;
+	vec3 w = max(gBary, vec3(0.0f));
+	w /= (w.x + w.y + w.z);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = min(int(x), R - 1);
+	int j = min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	vec3 c;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = min(fx, 1.0f);
+		fy = min(fy, 1.0f - fx);
+		c = fetch(i, j) * (1.0f - fx - fy) + fetch(i + 1, j) * fx + fetch(i, j + 1) * fy;
+	}
+	else {
+		c = fetch(i + 1, j + 1) * (fx + fy - 1.0f) + fetch(i, j + 1) * (1.0f - fx) + fetch(i + 1, j) * (1.0f - fy);
+	}
+	color = vec4(c, 1.0f);
+}
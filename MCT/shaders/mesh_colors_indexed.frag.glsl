@@ -0,0 +1,66 @@
+#version 430
+
+in vec3 gPos;
+in vec2 gTex;
+in vec3 gNormal;
+in vec3 gBary;
+
+out vec4 color;
+
+//palette indexed mesh colors, index of sample s in byte s (8 bits) or half of byte s/2 (4 bits)
+layout(binding = 2) uniform samplerBuffer mc_palette;
+layout(binding = 3) uniform usamplerBuffer mc_indices;
+uniform int mc_R;
+uniform int mc_index_bits;
+
+//same layout as mc_grid_slot in mc_buffer.h
+int grid_slot(int R, int i, int j, int k)
+{
+	int e = max(R - 1, 0);
+	if (i == R) return 0;
+	if (j == R) return 1;
+	if (k == R) return 2;
+	if (k == 0) return 3 + (j - 1);
+	if (i == 0) return 3 + e + (k - 1);
+	if (j == 0) return 3 + 2 * e + (i - 1);
+	int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+	return 3 + 3 * e + row + (j - 1);
+}
+
+vec3 fetch(int i, int j)
+{
+	int R = mc_R;
+	int s = gl_PrimitiveID * ((R + 1) * (R + 2) / 2) + grid_slot(R, i, j, R - i - j);
+	uint m;
+	if (mc_index_bits == 4) {
+		m = (texelFetch(mc_indices, s >> 1).r >> (4 * (s & 1))) & 15u;
+	}
+	else {
+		m = texelFetch(mc_indices, s).r;
+	}
+	return texelFetch(mc_palette, int(m)).rgb;
+}
+
+void main()
+{
+	//linear between the three nearest samples, same as mc_eval_patch
+	int R = mc_R;
+	vec3 w = max(gBary, vec3(0.0f));
+	w /= (w.x + w.y + w.z);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = min(int(x), R - 1);
+	int j = min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	vec3 c;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = min(fx, 1.0f);
+		fy = min(fy, 1.0f - fx);
+		c = fetch(i, j) * (1.0f - fx - fy) + fetch(i + 1, j) * fx + fetch(i, j + 1) * fy;
+	}
+	else {
+		c = fetch(i + 1, j + 1) * (fx + fy - 1.0f) + fetch(i, j + 1) * (1.0f - fx) + fetch(i + 1, j) * (1.0f - fy);
+	}
+	color = vec4(c, 1.0f);
+}
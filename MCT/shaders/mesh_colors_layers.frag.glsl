@@ -0,0 +1,122 @@
+#version 430
+
+in vec3 gPos;
+in vec2 gTex;
+in vec3 gNormal;
+in vec3 gBary;
+
+out vec4 color;
+
+//every layer of a sample in one texel of up to four words, layout of mc_layered in mc_layers.h
+layout(binding = 2) uniform usamplerBuffer mc_layers;
+uniform int mc_R;
+//byte offsets of the inputs inside a sample, -1 when there is no such layer
+uniform int mc_albedo_offset;
+uniform int mc_specular_offset;
+uniform int mc_normal_offset;
+uniform int mc_height_offset;
+//r8 color layers
+uniform bool mc_albedo_gray;
+uniform bool mc_specular_gray;
+//object space
+uniform vec3 mc_light_dir;
+uniform vec3 mc_eye;
+
+//same layout as mc_grid_slot in mc_buffer.h
+int grid_slot(int R, int i, int j, int k)
+{
+	int e = max(R - 1, 0);
+	if (i == R) return 0;
+	if (j == R) return 1;
+	if (k == R) return 2;
+	if (k == 0) return 3 + (j - 1);
+	if (i == 0) return 3 + e + (k - 1);
+	if (j == 0) return 3 + 2 * e + (i - 1);
+	int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+	return 3 + 3 * e + row + (j - 1);
+}
+
+uint byte_at(uvec4 t, int o)
+{
+	return (t[o >> 2] >> (8 * (o & 3))) & 255u;
+}
+
+vec3 color_at(uvec4 t, int o, bool gray)
+{
+	if (gray) return vec3(float(byte_at(t, o)) / 255.0f);
+	return vec3(byte_at(t, o), byte_at(t, o + 1), byte_at(t, o + 2)) / 255.0f;
+}
+
+//octahedron encoded unit vector in two half floats
+vec3 normal_at(uvec4 t, int o)
+{
+	uint bits = byte_at(t, o) | (byte_at(t, o + 1) << 8) | (byte_at(t, o + 2) << 16) | (byte_at(t, o + 3) << 24);
+	vec2 e = unpackHalf2x16(bits);
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f) {
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(n);
+}
+
+struct inputs {
+	vec3 albedo;
+	vec3 specular;
+	vec3 normal;
+	float height;
+};
+
+//one fetch for every input of a sample
+inputs fetch(int i, int j)
+{
+	int R = mc_R;
+	uvec4 t = texelFetch(mc_layers, gl_PrimitiveID * ((R + 1) * (R + 2) / 2) + grid_slot(R, i, j, R - i - j));
+	inputs s;
+	s.albedo = mc_albedo_offset >= 0 ? color_at(t, mc_albedo_offset, mc_albedo_gray) : vec3(0.8f);
+	s.specular = mc_specular_offset >= 0 ? color_at(t, mc_specular_offset, mc_specular_gray) : vec3(0.0f);
+	s.normal = mc_normal_offset >= 0 ? normal_at(t, mc_normal_offset) : vec3(0.0f);
+	s.height = mc_height_offset >= 0 ? float(byte_at(t, mc_height_offset)) / 255.0f : 1.0f;
+	return s;
+}
+
+inputs blend(inputs a, inputs b, inputs c, float wa, float wb, float wc)
+{
+	inputs s;
+	s.albedo = a.albedo * wa + b.albedo * wb + c.albedo * wc;
+	s.specular = a.specular * wa + b.specular * wb + c.specular * wc;
+	s.normal = a.normal * wa + b.normal * wb + c.normal * wc;
+	s.height = a.height * wa + b.height * wb + c.height * wc;
+	return s;
+}
+
+void main()
+{
+	//linear between the three nearest samples, same as mc_eval_patch
+	int R = mc_R;
+	vec3 w = max(gBary, vec3(0.0f));
+	w /= (w.x + w.y + w.z);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = min(int(x), R - 1);
+	int j = min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	inputs s;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = min(fx, 1.0f);
+		fy = min(fy, 1.0f - fx);
+		s = blend(fetch(i, j), fetch(i + 1, j), fetch(i, j + 1), 1.0f - fx - fy, fx, fy);
+	}
+	else {
+		s = blend(fetch(i + 1, j + 1), fetch(i, j + 1), fetch(i + 1, j), fx + fy - 1.0f, 1.0f - fx, 1.0f - fy);
+	}
+
+	//blinn-phong, the height layer darkens the ambient term in cavities
+	vec3 n = mc_normal_offset >= 0 ? normalize(s.normal) : normalize(gNormal);
+	vec3 l = normalize(mc_light_dir);
+	vec3 h = normalize(l + normalize(mc_eye - gPos));
+	vec3 ambient = s.albedo * 0.3f * mix(0.5f, 1.0f, s.height);
+	vec3 diffuse = s.albedo * max(0.0f, dot(n, l));
+	vec3 specular = s.specular * pow(max(0.0f, dot(n, h)), 32.0f);
+	color = vec4(ambient + diffuse + specular, 1.0f);
+}
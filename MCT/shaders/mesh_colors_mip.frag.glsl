@@ -0,0 +1,81 @@
+#version 430
+
+in vec3 gPos;
+in vec2 gTex;
+in vec3 gNormal;
+in vec3 gBary;
+
+out vec4 color;
+
+#define MC_MAX_LEVELS 12
+
+//mip levels resident on the gpu, finest first, offsets in samples
+layout(binding = 2) uniform samplerBuffer mesh_colors;
+uniform int mc_levels;
+uniform int mc_level_R[MC_MAX_LEVELS];
+uniform int mc_level_offset[MC_MAX_LEVELS];
+uniform float mc_lod_bias;
+
+//same layout as mc_grid_slot in mc_buffer.h
+int grid_slot(int R, int i, int j, int k)
+{
+	int e = max(R - 1, 0);
+	if (i == R) return 0;
+	if (j == R) return 1;
+	if (k == R) return 2;
+	if (k == 0) return 3 + (j - 1);
+	if (i == 0) return 3 + e + (k - 1);
+	if (j == 0) return 3 + 2 * e + (i - 1);
+	int row = (i - 1) * (R - 1) - ((i - 1) * i) / 2;
+	return 3 + 3 * e + row + (j - 1);
+}
+
+vec3 fetch(int base, int R, int i, int j)
+{
+	return texelFetch(mesh_colors, base + grid_slot(R, i, j, R - i - j)).rgb;
+}
+
+//linear between the three nearest samples, same as mc_eval_patch
+vec3 eval_level(int level, vec3 w)
+{
+	int R = mc_level_R[level];
+	int base = mc_level_offset[level] + gl_PrimitiveID * ((R + 1) * (R + 2) / 2);
+	w = max(w, vec3(0.0f));
+	w /= (w.x + w.y + w.z);
+	float x = w.x * R;
+	float y = w.y * R;
+	int i = min(int(x), R - 1);
+	int j = min(int(y), R - 1 - i);
+	float fx = x - i;
+	float fy = y - j;
+	if (fx + fy <= 1.0f || i + j + 2 > R) {
+		fx = min(fx, 1.0f);
+		fy = min(fy, 1.0f - fx);
+		return fetch(base, R, i, j) * (1.0f - fx - fy) + fetch(base, R, i + 1, j) * fx + fetch(base, R, i, j + 1) * fy;
+	}
+	return fetch(base, R, i + 1, j + 1) * (fx + fy - 1.0f) + fetch(base, R, i, j + 1) * (1.0f - fx) + fetch(base, R, i + 1, j) * (1.0f - fy);
+}
+
+void main()
+{
+	//samples of the first level per pixel, measured on the triangular lattice
+	float R0 = float(mc_level_R[0]);
+	vec3 g = gBary * R0;
+	vec2 p = vec2(g.y + 0.5f * g.z, 0.86602540378f * g.z);
+	float spp = max(length(dFdx(p)), length(dFdy(p))) * exp2(mc_lod_bias);
+	//resolution that gives one sample per pixel, then the two levels around it
+	float target = R0 / max(spp, 1e-6f);
+
+	int l = 0;
+	while (l + 1 < mc_levels && float(mc_level_R[l]) > target) {
+		l++;
+	}
+	if (l == 0 || float(mc_level_R[l]) > target) {
+		color = vec4(eval_level(l, gBary), 1.0f);
+		return;
+	}
+	float fine = float(mc_level_R[l - 1]);
+	float coarse = float(mc_level_R[l]);
+	float t = log2(fine / target) / log2(fine / coarse);
+	color = vec4(mix(eval_level(l - 1, gBary), eval_level(l, gBary), clamp(t, 0.0f, 1.0f)), 1.0f);
+}
@@ -1,9 +1,31 @@
 #include <iostream>
+#include <memory>
+#include <cstdlib>
 #include "../headers/window.h"
 #include "../headers/shader.h"
 #include <GLM/glm.hpp>
 #include "../headers/definitions.h"
 #include "../headers/mesh_loader.h"
+#include "../headers/topology.h"
+#include "../headers/mc_stream.h"
+#include "../headers/mc_upload.h"
+#include "../headers/mc_paint.h"
+#include "../headers/mc_lighting.h"
+#include "../headers/mc_detail.h"
+#include "../headers/mc_transfer.h"
+#include "../headers/mc_filter.h"
+#include "../headers/mc_adaptive.h"
+#include "../headers/mc_mip.h"
+#include "../headers/mc_convert.h"
+#include "../headers/mc_compact.h"
+#include "../headers/mc_atlas.h"
+#include "../headers/mc_order.h"
+#include "../headers/mc_block.h"
+#include "../headers/mc_palette.h"
+#include "../headers/mc_codec.h"
+#include "../headers/mc_progressive.h"
+#include "../headers/mc_sequence.h"
+#include "../headers/mc_layers.h"
 
 void render_image()
 {
@@ -20,8 +42,203 @@ arcball arc_cam;
 glm::mat4 M;
 camera_props cfg;
 
+//right mouse button paints mesh colors under the cursor
+bool painting = false;
+double paint_x, paint_y;
+//ctrl+z / ctrl+y requests, handled in the render loop
+int undo_requests = 0;
+int redo_requests = 0;
+//m switches between the uv texture and the mesh colors mip pyramid
+bool mip_view = false;
+//c switches to the compact mesh colors, every shared sample stored once
+bool compact_view = false;
+//a switches to the packed patch atlas, read with hardware bilinear filtering
+bool atlas_view = false;
+//b switches to block compressed mesh colors decoded in the fragment shader
+bool block_view = false;
+//t switches to the bc1 copy of the uv texture
+bool bcn_view = false;
+//q switches to palette indexed mesh colors
+bool indexed_view = false;
+//ctrl+s writes the colors to their progressive file, s reloads them coarse to fine over the next frames
+bool progressive_save = false;
+bool progressive_restart = false;
+//n plays custom_mc.mcsq into the colors, page up / page down jump between its keyframes
+bool sequence_playing = false;
+int sequence_jumps = 0;
+//v switches to the layered mesh colors, albedo, specular, normal and height from one fetch
+bool layered_view = false;
+
+//unsigned argument of a headless mode within [lo, hi], prints the usage when it is not one
+bool parse_arg(const char* arg, unsigned int lo, unsigned int hi, const char* usage, unsigned int& out)
+{
+	char* end = nullptr;
+	unsigned long long v = std::strtoull(arg, &end, 10);
+	if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || v < lo || v > hi) {
+		std::cout << "bad argument " << arg << ", usage: " << usage << std::endl;
+		return false;
+	}
+	out = (unsigned int)v;
+	return true;
+}
+
 int main(int argc, char **argv)
 {
+	//inputs of the headless modes: MCT export-geometry <model> <output>, the first mesh with its faces
+	//in the order the viewer keeps them, and MCT export-image <image> <output>
+	if (argc >= 4 && std::string(argv[1]) == "export-geometry")
+	{
+		std::vector<vertex> verts;
+		std::vector<unsigned int> inds, ordered;
+		if (!load_mesh_geometry(argv[2], verts, inds)) {
+			return -1;
+		}
+		face_order uv_order;
+		order_faces_uv(verts, inds, uv_order);
+		reorder_indices(inds, uv_order, ordered);
+		std::cout << verts.size() << " vertices, " << ordered.size() / 3 << " faces" << std::endl;
+		return write_geometry_blob(verts, ordered, argv[3]) ? 0 : -1;
+	}
+	if (argc >= 4 && std::string(argv[1]) == "export-image")
+	{
+		return write_image_blob(argv[2], argv[3]) ? 0 : -1;
+	}
+
+	//headless out of core bake: MCT bake <geometry> <image> <output> [R] [budget in MB]
+	if (argc >= 5 && std::string(argv[1]) == "bake")
+	{
+		const char* usage = "MCT bake <geometry> <image> <output> [R] [budget in MB]";
+		mc_stream_config bake_cfg;
+		unsigned int budget_mb = (unsigned int)(bake_cfg.memory_budget >> 20);
+		if ((argc >= 6 && !parse_arg(argv[5], 1, mc_colors_max_R, usage, bake_cfg.R)) ||
+			(argc >= 7 && !parse_arg(argv[6], 1, 1u << 20, usage, budget_mb))) {
+			return -1;
+		}
+		bake_cfg.memory_budget = size_t(budget_mb) << 20;
+		return stream_bake_mesh_colors(argv[2], argv[3], argv[4], bake_cfg) ? 0 : -1;
+	}
+
+	//headless lighting bake: MCT light <geometry> <colors> <output> [ao rays]
+	if (argc >= 5 && std::string(argv[1]) == "light")
+	{
+		std::vector<vertex> verts;
+		std::vector<unsigned int> inds;
+		mc_buffer albedo;
+		light_bake_config light_cfg;
+		if ((argc >= 6 && !parse_arg(argv[5], 0, 4096, "MCT light <geometry> <colors> <output> [ao rays]", light_cfg.ao_rays)) ||
+			!load_geometry_blob(argv[2], verts, inds) || !load_mc_buffer(argv[3], albedo)) {
+			return -1;
+		}
+		bvh tree(verts, inds);
+		return bake_lighting(tree, verts, inds, albedo, albedo, light_cfg) && save_mc_buffer(albedo, argv[4]) ? 0 : -1;
+	}
+
+	//headless high to low bake: MCT detail <low geometry> <high geometry> <output> [R] [high poly colors]
+	if (argc >= 5 && std::string(argv[1]) == "detail")
+	{
+		std::vector<vertex> low_verts, high_verts;
+		std::vector<unsigned int> low_inds, high_inds;
+		mc_buffer high_colors;
+		detail_bake_config detail_cfg;
+		if ((argc >= 6 && !parse_arg(argv[5], 1, mc_colors_max_R, "MCT detail <low geometry> <high geometry> <output> [R] [high poly colors]", detail_cfg.R)) ||
+			!load_geometry_blob(argv[2], low_verts, low_inds) || !load_geometry_blob(argv[3], high_verts, high_inds) ||
+			(argc >= 7 && !load_mc_buffer(argv[6], high_colors))) {
+			return -1;
+		}
+		if (argc >= 7) detail_cfg.mode = DETAIL_COLOR;
+		bvh high_tree(high_verts, high_inds);
+		mc_buffer detail;
+		size_t missed = bake_high_to_low(high_tree, high_verts, high_inds, &high_colors, low_verts, low_inds, detail, detail_cfg);
+		std::cout << missed << " samples found no high poly surface" << std::endl;
+		return save_mc_buffer(detail, argv[4]) ? 0 : -1;
+	}
+
+	//headless colors transfer: MCT transfer <source geometry> <source colors> <target geometry> <output> [R]
+	if (argc >= 6 && std::string(argv[1]) == "transfer")
+	{
+		std::vector<vertex> src_verts, dst_verts;
+		std::vector<unsigned int> src_inds, dst_inds;
+		mc_buffer src_colors;
+		transfer_config transfer_cfg;
+		if ((argc >= 7 && !parse_arg(argv[6], 1, mc_colors_max_R, "MCT transfer <source geometry> <source colors> <target geometry> <output> [R]", transfer_cfg.R)) ||
+			!load_geometry_blob(argv[2], src_verts, src_inds) || !load_mc_buffer(argv[3], src_colors) ||
+			!load_geometry_blob(argv[4], dst_verts, dst_inds)) {
+			return -1;
+		}
+		bvh src_tree(src_verts, src_inds);
+		mc_buffer transferred;
+		size_t missed = transfer_mesh_colors(src_tree, src_colors, dst_verts, dst_inds, transferred, transfer_cfg);
+		if (missed > 0) {
+			std::cout << missed << " samples found no source surface" << std::endl;
+		}
+		return save_mc_buffer(transferred, argv[5]) ? 0 : -1;
+	}
+
+	//headless resolution change of baked colors: MCT resample <colors> <output> <R>
+	if (argc >= 5 && std::string(argv[1]) == "resample")
+	{
+		mc_buffer baked;
+		unsigned int R;
+		if (!parse_arg(argv[4], 1, mc_colors_max_R, "MCT resample <colors> <output> <R>", R) || !load_mc_buffer(argv[2], baked)) {
+			return -1;
+		}
+		return convert_mc_resolution(baked, R) && save_mc_buffer(baked, argv[3]) ? 0 : -1;
+	}
+
+	//headless animation sequence from baked frames: MCT sequence <output> <colors frame 0> <colors frame 1> ..
+	if (argc >= 4 && std::string(argv[1]) == "sequence")
+	{
+		mc_sequence_writer writer;
+		mc_buffer frame;
+		for (int a = 3; a < argc; a++)
+		{
+			if (!load_mc_buffer(argv[a], frame) || (a == 3 && !writer.open(argv[2], frame.R, frame.face_count)) || !writer.add(frame)) {
+				return -1;
+			}
+		}
+		std::cout << writer.frames() << " frames, " << writer.keyframe_count() << " keyframes" << std::endl;
+		return writer.close() ? 0 : -1;
+	}
+
+	//headless coarse to fine copy for streaming: MCT progressive <geometry> <colors> <output>
+	if (argc >= 5 && std::string(argv[1]) == "progressive")
+	{
+		std::vector<vertex> verts;
+		std::vector<unsigned int> inds;
+		mc_buffer baked;
+		if (!load_geometry_blob(argv[2], verts, inds) || !load_mc_buffer(argv[3], baked)) {
+			return -1;
+		}
+		mesh_topology progressive_topo;
+		weld_vertices(verts, progressive_topo);
+		build_half_edges(inds, progressive_topo);
+		return save_mc_progressive(baked, progressive_topo, argv[4]) ? 0 : -1;
+	}
+
+	//headless predictive coding for distribution: MCT pack <geometry> <colors> <output> [faces per chunk]
+	//and back: MCT unpack <geometry> <packed colors> <output>
+	if (argc >= 5 && (std::string(argv[1]) == "pack" || std::string(argv[1]) == "unpack"))
+	{
+		std::vector<vertex> verts;
+		std::vector<unsigned int> inds;
+		if (!load_geometry_blob(argv[2], verts, inds)) {
+			return -1;
+		}
+		mesh_topology codec_topo;
+		weld_vertices(verts, codec_topo);
+		build_half_edges(inds, codec_topo);
+		mc_buffer coded;
+		if (std::string(argv[1]) == "unpack") {
+			return load_mc_coded(argv[3], codec_topo, coded) && save_mc_buffer(coded, argv[4]) ? 0 : -1;
+		}
+		mc_codec_config codec_cfg;
+		if ((argc >= 6 && !parse_arg(argv[5], 1, 0xFFFFFFFFu, "MCT pack <geometry> <colors> <output> [faces per chunk]", codec_cfg.chunk)) ||
+			!load_mc_buffer(argv[3], coded)) {
+			return -1;
+		}
+		return save_mc_coded(coded, codec_topo, argv[4], codec_cfg) ? 0 : -1;
+	}
+
 	if (!glfwInit())
 	{
 		std::cout << "cant initialize glfw" << std::endl;
@@ -49,10 +266,58 @@ int main(int argc, char **argv)
 		case GLFW_KEY_F:
 			GLCall(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
 			break;
+		case GLFW_KEY_Z:
+			if ((mods & GLFW_MOD_CONTROL) && action != GLFW_RELEASE) undo_requests++;
+			break;
+		case GLFW_KEY_Y:
+			if ((mods & GLFW_MOD_CONTROL) && action != GLFW_RELEASE) redo_requests++;
+			break;
+		case GLFW_KEY_M:
+			if (action == GLFW_PRESS) mip_view = !mip_view;
+			break;
+		case GLFW_KEY_C:
+			if (action == GLFW_PRESS) compact_view = !compact_view;
+			break;
+		case GLFW_KEY_A:
+			if (action == GLFW_PRESS) atlas_view = !atlas_view;
+			break;
+		case GLFW_KEY_B:
+			if (action == GLFW_PRESS) block_view = !block_view;
+			break;
+		case GLFW_KEY_T:
+			if (action == GLFW_PRESS) bcn_view = !bcn_view;
+			break;
+		case GLFW_KEY_Q:
+			if (action == GLFW_PRESS) indexed_view = !indexed_view;
+			break;
+		case GLFW_KEY_S:
+			if (action == GLFW_PRESS) {
+				if (mods & GLFW_MOD_CONTROL) progressive_save = true;
+				else progressive_restart = true;
+			}
+			break;
+		case GLFW_KEY_N:
+			if (action == GLFW_PRESS) sequence_playing = !sequence_playing;
+			break;
+		case GLFW_KEY_PAGE_UP:
+			if (action != GLFW_RELEASE) sequence_jumps--;
+			break;
+		case GLFW_KEY_PAGE_DOWN:
+			if (action != GLFW_RELEASE) sequence_jumps++;
+			break;
+		case GLFW_KEY_V:
+			if (action == GLFW_PRESS) layered_view = !layered_view;
+			break;
 		}
 	};
 
 	mousebuttoncallback mbtn_cb = [](GLFWwindow* window, int button, int action, int mods) {
+		if (button == GLFW_MOUSE_BUTTON_RIGHT)
+		{
+			painting = (action == GLFW_PRESS);
+			glfwGetCursorPos(window, &paint_x, &paint_y);
+			return;
+		}
 		if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 		{
 			arc_cam.active = true;
@@ -70,6 +335,11 @@ int main(int argc, char **argv)
 	};
 
 	mousecallback mcb = [](GLFWwindow* window, double xpos, double ypos) {
+		if (painting)
+		{
+			paint_x = xpos;
+			paint_y = ypos;
+		}
 		if (arc_cam.active)
 		{
 
@@ -102,6 +372,11 @@ int main(int argc, char **argv)
 	std::string flash_path = "obj/flash/flash_new.obj";
 	GLuint tex_id;
 	Shader drawMesh("shaders/standard_mvp.vert.glsl", "shaders/albedo_shade.frag.glsl");
+	Shader drawMeshMip("shaders/standard_mvp.vert.glsl", "shaders/mesh_colors_mip.frag.glsl", "shaders/mc_barycentric.geom.glsl");
+	Shader drawMeshBlock("shaders/standard_mvp.vert.glsl", "shaders/mesh_colors_block.frag.glsl", "shaders/mc_barycentric.geom.glsl");
+	Shader drawMeshIndexed("shaders/standard_mvp.vert.glsl", "shaders/mesh_colors_indexed.frag.glsl", "shaders/mc_barycentric.geom.glsl");
+	Shader drawMeshCompact("shaders/standard_mvp.vert.glsl", "shaders/mesh_colors_compact.frag.glsl", "shaders/mc_barycentric.geom.glsl");
+	Shader drawMeshLayers("shaders/standard_mvp.vert.glsl", "shaders/mesh_colors_layers.frag.glsl", "shaders/mc_barycentric.geom.glsl");
 	mesh_loader mesh(kirby_path.c_str());
 	
 	//how many models
@@ -137,11 +412,21 @@ int main(int argc, char **argv)
 	//	std::cout << (int)a.r << " " << (int)a.g << " " << (int)a.b << std::endl;
 	//}			
 	
+	//faces along a hilbert curve of their uv centroids, so the bake reads and the scatter
+	//writes of consecutive faces land on neighbouring texels, uv_order maps back to the file order
+	face_order uv_order;
+	order_faces_uv(mesh.models[0].vertices, mesh.models[0].indices, uv_order);
+	reorder_model_faces(mesh.models[0], uv_order);
+
 	//"obj/kirby/kdiff.png"
 	//"obj/flash/FL_CW_A_1.png"
 	//"obj/mini_box_knight/mini_knight.png"
 	mesh_colors2 mc2(mesh.models[0], "obj/kirby/kdiff.png", 3);
 	rect2D r2(mc2.wid, mc2.hei);
+	//large targets are scattered to in tiles, uploads and exports go through to_linear
+	if (size_t(mc2.wid) * mc2.hei >= size_t(4096) * 4096) {
+		r2.set_layout(RECT_TILED);
+	}
 	custom_mesh_color_texture(mc2, r2);
 	r2.export_bmp2("custom_mc.bmp");	
 		
@@ -149,6 +434,20 @@ int main(int argc, char **argv)
 
 	std::cout << "mesh colors has : " << mc2.faces.size() << " faces" << std::endl;
 
+	//welded connectivity, render vertices are split along uv seams
+	mesh_topology topo;
+	build_topology(mesh.models[0], topo);
+	std::cout << "topology has : " << topo.vertex_count() << " welded vertices, " << topo.edge_count() << " edges" << std::endl;
+
+	//per face resolution from texel density, compared to the single R of mc2
+	summed_area_table mc2_sat;
+	mc2_sat.build(mc2.image.data(), mc2.wid, mc2.hei);
+	mc_adaptive_buffer adaptive;
+	choose_resolutions(mc2.vertices, mc2.indices, topo, mc2.wid, mc2.hei, mc_adaptive_config(), adaptive);
+	build_mc_adaptive(mc2.vertices, mc2.indices, topo, mc2_sat, adaptive);
+	std::cout << "adaptive mesh colors: " << adaptive.colors.size() << " samples, uniform R = " << mc2.faces[0].R
+		<< ": " << mc2.faces.size() * mc_face_samples(mc2.faces[0].R) << " samples" << std::endl;
+
 	//for (size_t i = 0; i < mc2.faces.size(); i++) {
 	//	if (mc2.faces[i].v_index[0] >= 1048576) {
 	//		std::cout << "found bug at " << i << " " << mc2.faces[i].v_index[0] << std::endl;
@@ -167,19 +466,348 @@ int main(int argc, char **argv)
 	GLuint t_id;
 	gen_rectangle_texture(r2, t_id);
 
+	//bc1 copy with mips for viewing, t_id stays uncompressed for the partial updates of edits
+	GLuint bcn_id = 0;
+	bool bcn_ok = bcn_supported();
+	bool bcn_stale = false;
+	if (bcn_ok) {
+		gen_bcn_rectangle_texture(r2, bcn_id, "custom_mc.bcn");
+	}
+	else {
+		std::cout << "s3tc textures not supported, t shows the uncompressed texture" << std::endl;
+	}
+
+	//editable per face colors, edits are re-uploaded to t_id once per frame
+	//area filtered resampling, build_mc_buffer(mc2, colors) keeps the point sampled colors
+	mc_buffer colors;
+	build_mc_buffer_filtered(mc2.vertices, mc2.indices, mc2_sat, mc2.faces[0].R, colors);
+	mc_texture_proxy colors_proxy(mc2, r2, t_id);
+
+	bvh mesh_bvh(mesh.models[0]);
+	mc_history history(colors);
+	mc_painter painter(mesh_bvh, colors, &history);
+	brush paint_brush;
+	bool was_painting = false;
+
+	//mip pyramid of the editable colors, rebuilt after edits while it is on screen
+	mc_mip_chain colors_mips;
+	mc_mip_gpu colors_mips_gpu;
+	bool mips_stale = true;
+	float mean_edge = 0.0f;
+	{
+		const Model& m = mesh.models[0];
+		for (size_t i = 0; i < m.indices.size(); i++) {
+			size_t j = i % 3 == 2 ? i - 2 : i + 1;
+			mean_edge += glm::length(m.vertices[m.indices[j]].pos - m.vertices[m.indices[i]].pos);
+		}
+		mean_edge /= float(std::max<size_t>(1, m.indices.size()));
+	}
+
+	//compact copy of the editable colors, rebuilt after edits while it is on screen
+	mc_compact colors_compact;
+	mc_compact_gpu colors_compact_gpu;
+	bool compact_stale = true;
+	//edges and interiors within flat_tolerance of one color keep only that color
+	const unsigned int flat_tolerance = 2;
+	build_mc_compact(colors, topo, colors_compact);
+	collapse_mc_compact(colors_compact, flat_tolerance);
+	std::cout << "compact mesh colors: " << colors_compact.colors.size() << " samples, " << (colors_compact.bytes() >> 10)
+		<< " KB against " << ((colors.colors.size() * sizeof(rgb)) >> 10) << " KB per face, " << colors_compact.constant_edges
+		<< " flat edges, " << colors_compact.constant_faces << " flat faces" << std::endl;
+
+	//patch atlas with its own per corner uvs, the packing stays, texels are refilled after edits
+	mc_atlas colors_atlas;
+	build_mc_atlas(colors, colors_atlas);
+	std::vector<vertex> atlas_verts;
+	std::vector<unsigned int> atlas_inds;
+	build_atlas_mesh(mesh.models[0].vertices, mesh.models[0].indices, colors_atlas, atlas_verts, atlas_inds);
+	Model atlas_model(atlas_verts, atlas_inds, std::vector<Texture>());
+	GLuint atlas_id;
+	gen_atlas_texture(colors_atlas, atlas_id);
+	bool atlas_stale = false;
+
+	//copies that take a full re-encode are refreshed once a stroke ends, at most every reencode_interval seconds
+	const double reencode_interval = 1.0;
+	//block compressed copy, re-encoded after edits while it is on screen
+	mc_compressed colors_blocks;
+	mc_block_gpu colors_blocks_gpu;
+	bool blocks_stale = true;
+	double blocks_time = -reencode_interval;
+	//the bc1 copy re-encodes every mip of the texture
+	double bcn_time = -reencode_interval;
+	//palette indexed copy, clustered again after edits while it is on screen
+	mc_indexed colors_indexed;
+	mc_indexed_gpu colors_indexed_gpu;
+	mc_palette_config palette_cfg;
+	bool indexed_stale = true;
+	double indexed_time = -reencode_interval;
+	std::cout << "mesh colors atlas: " << colors_atlas.wid << " x " << colors_atlas.hei << ", fill rate " << colors_atlas.fill_rate()
+		<< " against " << mc2.wid << " x " << mc2.hei << std::endl;
+
+	//coarse to fine copy of the colors, read back progressive_block bytes per frame
+	const size_t progressive_block = size_t(1) << 20;
+	std::vector<unsigned char> progressive_bytes(progressive_block);
+	std::unique_ptr<mc_progressive_reader> progressive_reader;
+	std::ifstream progressive_in;
+
+	//every material map of the model baked as a layer of one mesh colors record, the painted colors are not in it
+	mc_layered layered;
+	mc_layered_gpu layered_gpu;
+	bool layered_ok = false;
+	{
+		std::vector<mc_layer_source> sources;
+		for (const Texture& t : mesh.models[0].textures)
+		{
+			mc_layer_source src;
+			std::string path = mesh.directory + '/' + t.path;
+			bool loaded = false;
+			if (t.type == "texture_diffuse") loaded = load_mc_layer_source(path.c_str(), MC_ROLE_ALBEDO, MC_LAYER_RGB8, src);
+			else if (t.type == "texture_specular") loaded = load_mc_layer_source(path.c_str(), MC_ROLE_SPECULAR, MC_LAYER_RGB8, src);
+			else if (t.type == "texture_normal") loaded = load_mc_layer_source(path.c_str(), MC_ROLE_NORMAL, MC_LAYER_RG16F, src);
+			else if (t.type == "texture_height") loaded = load_mc_layer_source(path.c_str(), MC_ROLE_HEIGHT, MC_LAYER_R8, src);
+			//one layer per role
+			bool taken = false;
+			for (const mc_layer_source& other : sources) taken = taken || other.role == src.role;
+			if (loaded && !taken) sources.push_back(std::move(src));
+		}
+		if (sources.empty()) {
+			mc_layer_source src;
+			if (load_mc_layer_source("obj/kirby/kdiff.png", MC_ROLE_ALBEDO, MC_LAYER_RGB8, src)) sources.push_back(std::move(src));
+		}
+		layered_ok = !sources.empty() && bake_mc_layers(mc2.vertices, mc2.indices, sources, mc2.faces[0].R, layered);
+		if (layered_ok) {
+			layered_gpu.upload(layered);
+			std::cout << "layered mesh colors: " << layered.layers.size() << " layers, " << layered.stride << " bytes a sample, "
+				<< (layered.bytes() >> 10) << " KB" << std::endl;
+		}
+	}
+
+	//baked animation, if there is one for this mesh, played into its own buffer so the deltas never meet edits
+	mc_sequence_player sequence;
+	mc_buffer sequence_colors;
+	bool sequence_ok = sequence.open("custom_mc.mcsq") && sequence.matches(colors);
+	//a playback run or a jump is one undo step, colors written elsewhere get the whole frame on the next one
+	bool sequence_step = false;
+	bool sequence_synced = false;
+	if (sequence_ok) {
+		std::cout << "sequence of " << sequence.frame_count() << " frames, n plays it" << std::endl;
+	}
+
 	while (!glfwWindowShouldClose(window.wnd))
 	{
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		//a jump or a paused playback closes its step before anything else opens one
+		if (sequence_step && (painting || !sequence_playing || !sequence_ok)) {
+			history.end_step();
+			sequence_step = false;
+		}
+		//one undo step per stroke, a progressive reload keeps its own step open and strokes wait for it
+		bool stroke = painting && !progressive_reader;
+		if (stroke && !was_painting) history.begin_step();
+		if (!stroke && was_painting) history.end_step();
+		was_painting = stroke;
+		if (stroke) {
+			painter.paint_at(paint_x, paint_y, cfg, M, paint_brush);
+			sequence_synced = false;
+		}
+		//undo closes the open step, requests made during a stroke, a reload or a playback wait for it to end
+		if (!painting && !progressive_reader && !sequence_step && undo_requests + redo_requests > 0) {
+			for (; undo_requests > 0; undo_requests--) history.undo();
+			for (; redo_requests > 0; redo_requests--) history.redo();
+			sequence_synced = false;
+		}
+		if (progressive_save)
+		{
+			if (save_mc_progressive(colors, topo, "custom_mc.mcpg")) {
+				std::cout << "colors written to custom_mc.mcpg" << std::endl;
+			}
+			progressive_save = false;
+		}
+		if (progressive_restart && !painting && !sequence_step)
+		{
+			progressive_in.close();
+			progressive_in.clear();
+			progressive_in.open("custom_mc.mcpg", std::ios::binary);
+			if (progressive_in) {
+				//the whole reload is one undo step, every sample is saved before the first level lands
+				history.begin_step();
+				history.before_write(0, colors.colors.size());
+				progressive_reader.reset(new mc_progressive_reader(topo));
+			}
+			else {
+				std::cout << "no custom_mc.mcpg, ctrl+s writes one" << std::endl;
+			}
+			progressive_restart = false;
+		}
+		if (progressive_reader)
+		{
+			progressive_in.read((char*)progressive_bytes.data(), progressive_bytes.size());
+			bool more = progressive_in.gcount() > 0 && progressive_reader->feed(progressive_bytes.data(), size_t(progressive_in.gcount()));
+			progressive_reader->refine(colors);
+			sequence_synced = false;
+			if (!more || progressive_reader->done()) {
+				std::cout << "progressive colors: " << progressive_reader->levels_done() << " of " << progressive_reader->level_count()
+					<< " levels, " << int(progressive_reader->progress() * 100.0f) << "% read" << std::endl;
+				progressive_reader.reset();
+				history.end_step();
+			}
+		}
+		if (sequence_ok && !painting && !progressive_reader && (sequence_playing || sequence_jumps != 0))
+		{
+			unsigned int at = sequence.frame() < sequence.frame_count() ? sequence.frame() : 0;
+			for (; sequence_jumps > 0; sequence_jumps--) at = sequence.keyframe_after(at);
+			for (; sequence_jumps < 0; sequence_jumps++) at = sequence.keyframe_before(at > 0 ? at - 1 : 0);
+			if (at != sequence.frame()) {
+				sequence_ok = sequence.seek(at, sequence_colors);
+			}
+			else if (sequence_playing) {
+				sequence_ok = sequence.next(sequence_colors);
+			}
+			//only the chunks a frame changes are copied and uploaded, all of it after other writes
+			if (sequence_ok)
+			{
+				if (!sequence_step) {
+					history.begin_step();
+					sequence_step = true;
+				}
+				std::vector<sample_range> changed = sequence_colors.dirty.take();
+				if (!sequence_synced) {
+					changed.assign(1, sample_range{ 0, colors.colors.size() });
+					sequence_synced = true;
+				}
+				for (const sample_range& r : changed)
+				{
+					history.before_write(r.begin, r.end);
+					std::copy(sequence_colors.colors.begin() + r.begin, sequence_colors.colors.begin() + r.end, colors.colors.begin() + r.begin);
+					colors.dirty.add(r.begin, r.end);
+				}
+			}
+		}
+		if (!colors.dirty.empty()) mips_stale = compact_stale = atlas_stale = blocks_stale = bcn_stale = indexed_stale = true;
+		colors_proxy.flush(colors);
+
 		glm::mat4 MVP = cfg.P * cfg.V * M;
 
-		drawMesh.use();
-		drawMesh.setMat4("MVP", MVP);
-				
-		drawMesh.setInt("mesh_color", 1);
-		bind_texture_unit(1,t_id);		
+		if (layered_view && layered_ok)
+		{
+			//light from above the camera at rest, both in object space
+			glm::mat4 inv_M = glm::inverse(M);
+			glm::vec3 light = glm::normalize(glm::vec3(inv_M * glm::vec4(0.0f, 1.0f, 1.0f, 0.0f)));
+			glm::vec3 eye = glm::vec3(glm::inverse(cfg.V * M)[3]);
+			drawMeshLayers.use();
+			drawMeshLayers.setMat4("MVP", MVP);
+			layered_gpu.set_uniforms(drawMeshLayers, light, eye);
+			layered_gpu.bind(2);
+			mesh.Draw(drawMeshLayers);
+		}
+		else if (indexed_view)
+		{
+			//built on first use, mid-stroke too since there is nothing to show before
+			bool first = colors_indexed.palette.empty();
+			if (first || (indexed_stale && !painting && glfwGetTime() - indexed_time >= reencode_interval)) {
+				quantize_mc_colors(colors, palette_cfg, colors_indexed);
+				colors_indexed_gpu.upload(colors_indexed);
+				indexed_stale = false;
+				indexed_time = glfwGetTime();
+				if (first) {
+					std::cout << "indexed mesh colors: " << colors_indexed.palette.size() << " colors, " << (colors_indexed.bytes() >> 10)
+						<< " KB against " << ((colors.colors.size() * sizeof(rgb)) >> 10) << " KB, psnr " << colors_indexed.psnr() << " dB" << std::endl;
+				}
+			}
+			drawMeshIndexed.use();
+			drawMeshIndexed.setMat4("MVP", MVP);
+			colors_indexed_gpu.set_uniforms(drawMeshIndexed);
+			colors_indexed_gpu.bind(2);
+			mesh.Draw(drawMeshIndexed);
+		}
+		else if (block_view)
+		{
+			//built on first use even mid-stroke, there is nothing to show before
+			if (colors_blocks.blocks.empty() || (blocks_stale && !painting && glfwGetTime() - blocks_time >= reencode_interval)) {
+				encode_mc_blocks(colors, colors_blocks);
+				colors_blocks_gpu.upload(colors_blocks);
+				blocks_stale = false;
+				blocks_time = glfwGetTime();
+			}
+			drawMeshBlock.use();
+			drawMeshBlock.setMat4("MVP", MVP);
+			colors_blocks_gpu.set_uniforms(drawMeshBlock);
+			colors_blocks_gpu.bind(2);
+			mesh.Draw(drawMeshBlock);
+		}
+		else if (atlas_view)
+		{
+			if (atlas_stale) {
+				fill_mc_atlas(colors, colors_atlas);
+				update_atlas_texture(colors_atlas, atlas_id);
+				atlas_stale = false;
+			}
+			drawMesh.use();
+			drawMesh.setMat4("MVP", MVP);
+			drawMesh.setInt("mesh_color", 1);
+			bind_texture_unit(1, atlas_id);
+			atlas_model.Draw(drawMesh);
+		}
+		else if (compact_view)
+		{
+			if (compact_stale) {
+				build_mc_compact(colors, topo, colors_compact);
+				collapse_mc_compact(colors_compact, flat_tolerance);
+				colors_compact_gpu.upload(colors_compact);
+				compact_stale = false;
+			}
+			drawMeshCompact.use();
+			drawMeshCompact.setMat4("MVP", MVP);
+			colors_compact_gpu.set_uniforms(drawMeshCompact);
+			colors_compact_gpu.bind(2);
+			mesh.Draw(drawMeshCompact);
+		}
+		else if (mip_view)
+		{
+			//only the levels this distance can read are kept on the gpu, one finer for close up faces
+			glm::vec4 center = cfg.V * M * glm::vec4(mesh.bb_mid, 1.0f);
+			float edge_pixels = mean_edge * glm::length(glm::vec3(M[0])) * cfg.P[1][1] * 0.5f * cfg.height / std::max(-center.z, cfg.znear);
+			bool rebuilt = mips_stale;
+			if (mips_stale) {
+				build_mc_mip_chain(colors, colors_mips);
+				mips_stale = false;
+			}
+			unsigned int first = mc_mip_select(colors_mips, edge_pixels);
+			first = first > 0 ? first - 1 : 0;
+			if (rebuilt || first != colors_mips_gpu.first_level) {
+				colors_mips_gpu.upload(colors_mips, first);
+			}
+
+			drawMeshMip.use();
+			drawMeshMip.setMat4("MVP", MVP);
+			colors_mips_gpu.set_uniforms(drawMeshMip);
+			colors_mips_gpu.bind(2);
+			mesh.Draw(drawMeshMip);
+		}
+		else if (bcn_view && bcn_ok)
+		{
+			if (bcn_stale && !painting && glfwGetTime() - bcn_time >= reencode_interval) {
+				update_bcn_rectangle_texture(r2, bcn_id);
+				bcn_stale = false;
+				bcn_time = glfwGetTime();
+			}
+			drawMesh.use();
+			drawMesh.setMat4("MVP", MVP);
+			drawMesh.setInt("mesh_color", 1);
+			bind_texture_unit(1, bcn_id);
+			mesh.Draw(drawMesh);
+		}
+		else
+		{
+			drawMesh.use();
+			drawMesh.setMat4("MVP", MVP);
+
+			drawMesh.setInt("mesh_color", 1);
+			bind_texture_unit(1, t_id);
 
-		mesh.Draw(drawMesh);	
+			mesh.Draw(drawMesh);
+		}
 		//auto i = glGetUniformLocation(drawMesh.ID, "mesh_color");
 		//auto j = glGetUniformLocation(drawMesh.ID, "texture_diffuse1");
 		//std::cout << i << std::endl;
@@ -0,0 +1,358 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "../headers/mc_bcn.h"
+#include "../headers/bc1_encode.h"
+#include "../headers/parallel.h"
+#include "../headers/gl_macro.h"
+
+/* Cache file: bcn_file_header, then for every level its width and height as two
+   unsigned ints followed by its blocks. */
+struct bcn_file_header {
+	char magic[4];
+	unsigned int version;
+	unsigned int format;
+	unsigned int levels;
+	uint64_t hash;
+};
+
+const char bcn_magic[4] = { 'M', 'C', 'B', 'N' };
+
+namespace {
+	void put16(unsigned char* dst, unsigned int v)
+	{
+		dst[0] = (unsigned char)(v & 0xFF);
+		dst[1] = (unsigned char)((v >> 8) & 0xFF);
+	}
+
+	unsigned int get16(const unsigned char* src)
+	{
+		return unsigned(src[0]) | (unsigned(src[1]) << 8);
+	}
+
+	size_t level_bytes(unsigned int w, unsigned int h, unsigned int block_bytes)
+	{
+		return size_t((w + 3) / 4) * ((h + 3) / 4) * block_bytes;
+	}
+
+	//levels of a chain down to 1x1
+	size_t mip_count(unsigned int w, unsigned int h)
+	{
+		size_t n = 1;
+		for (; w > 1 || h > 1; n++) {
+			w = std::max(1u, w / 2);
+			h = std::max(1u, h / 2);
+		}
+		return n;
+	}
+
+	//bc1 is in four color mode when color0 > color1, its indices run c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+	void write_bc1(const mc_block& b, unsigned char* dst)
+	{
+		static const uint32_t bc1_index[4] = { 0, 2, 3, 1 };
+		unsigned int e0 = b.endpoints & 0xFFFF, e1 = b.endpoints >> 16;
+		uint32_t idx = 0;
+		if (e0 != e1)
+		{
+			bool swap = e0 < e1;
+			for (int m = 0; m < MC_BLOCK_SAMPLES; m++)
+			{
+				uint32_t k = (b.indices >> (2 * m)) & 3;
+				idx |= bc1_index[swap ? 3 - k : k] << (2 * m);
+			}
+			if (swap) {
+				std::swap(e0, e1);
+			}
+		}
+		put16(dst, e0);
+		put16(dst + 2, e1);
+		put16(dst + 4, idx & 0xFFFF);
+		put16(dst + 6, idx >> 16);
+	}
+
+	//alpha block of bc3: the two extremes and 3 bit indices in eight value mode, a0 > a1
+	void write_bc3_alpha(const unsigned char* a, unsigned char* dst)
+	{
+		unsigned int a0 = 0, a1 = 255;
+		for (int m = 0; m < MC_BLOCK_SAMPLES; m++)
+		{
+			a0 = std::max(a0, unsigned(a[m]));
+			a1 = std::min(a1, unsigned(a[m]));
+		}
+		uint64_t bits = 0;
+		if (a0 > a1) {
+			//step p of 7 from a0 to a1 is index 0 and 1 at the ends, p + 1 in between
+			float scale = 7.0f / float(a0 - a1);
+			for (int m = 0; m < MC_BLOCK_SAMPLES; m++)
+			{
+				unsigned int p = (unsigned int)(float(a0 - a[m]) * scale + 0.5f);
+				uint64_t idx = p == 0 ? 0 : (p >= 7 ? 1 : p + 1);
+				bits |= idx << (3 * m);
+			}
+		}
+		dst[0] = (unsigned char)a0;
+		dst[1] = (unsigned char)a1;
+		for (int n = 0; n < 6; n++) {
+			dst[2 + n] = (unsigned char)((bits >> (8 * n)) & 0xFF);
+		}
+	}
+
+	//4x4 block at block (bx, by), texels past the edge repeat the last row and column
+	void encode_bcn_block(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels,
+		unsigned int bx, unsigned int by, unsigned char* dst)
+	{
+		block_samples s;
+		unsigned char alpha[MC_BLOCK_SAMPLES];
+		s.n = MC_BLOCK_SAMPLES;
+		for (unsigned int y = 0; y < 4; y++) {
+			for (unsigned int x = 0; x < 4; x++)
+			{
+				unsigned int px = std::min(bx * 4 + x, w - 1), py = std::min(by * 4 + y, h - 1);
+				const unsigned char* p = pixels + (size_t(py) * w + px) * channels;
+				unsigned int m = y * 4 + x;
+				s.r[m] = p[0];
+				s.g[m] = p[1];
+				s.b[m] = p[2];
+				alpha[m] = channels == 4 ? p[3] : 255;
+			}
+		}
+		if (channels == 4) {
+			write_bc3_alpha(alpha, dst);
+			dst += 8;
+		}
+		write_bc1(encode_block(s), dst);
+	}
+
+	void encode_bcn_level(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels, bcn_level& out)
+	{
+		unsigned int bw = (w + 3) / 4, bh = (h + 3) / 4;
+		unsigned int block_bytes = channels == 4 ? 16 : 8;
+		out.wid = w;
+		out.hei = h;
+		out.blocks.resize(level_bytes(w, h, block_bytes));
+		parallel_for(0, size_t(bw) * bh, [&](size_t b) {
+			encode_bcn_block(pixels, w, h, channels, unsigned(b % bw), unsigned(b / bw), out.blocks.data() + b * block_bytes);
+		});
+	}
+
+	//2x2 box filter, the last row or column of odd sizes is dropped
+	void half_level(const unsigned char* src, unsigned int w, unsigned int h, unsigned int channels,
+		std::vector<unsigned char>& dst, unsigned int& w2, unsigned int& h2)
+	{
+		w2 = std::max(1u, w / 2);
+		h2 = std::max(1u, h / 2);
+		dst.resize(size_t(w2) * h2 * channels);
+		parallel_for(0, size_t(w2) * h2, [&](size_t i) {
+			unsigned int x = unsigned(i % w2), y = unsigned(i / w2);
+			unsigned int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+			unsigned int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+			for (unsigned int c = 0; c < channels; c++)
+			{
+				unsigned int sum = src[(size_t(y0) * w + x0) * channels + c] + src[(size_t(y0) * w + x1) * channels + c]
+					+ src[(size_t(y1) * w + x0) * channels + c] + src[(size_t(y1) * w + x1) * channels + c];
+				dst[i * channels + c] = (unsigned char)((sum + 2) / 4);
+			}
+		});
+	}
+
+	//colors of a bc1 block the way the hardware expands them, bc3 is always in four color mode
+	void bc1_palette(const unsigned char* src, bool four_colors, int out[4][3])
+	{
+		unsigned int c0 = get16(src), c1 = get16(src + 2);
+		glm::vec3 e0 = from565(uint16_t(c0)), e1 = from565(uint16_t(c1));
+		for (int n = 0; n < 3; n++)
+		{
+			int a = int(e0[n]), b = int(e1[n]);
+			out[0][n] = a;
+			out[1][n] = b;
+			if (four_colors || c0 > c1) {
+				out[2][n] = (2 * a + b) / 3;
+				out[3][n] = (a + 2 * b) / 3;
+			}
+			else {
+				out[2][n] = (a + b) / 2;
+				out[3][n] = 0;
+			}
+		}
+	}
+};
+
+uint64_t bcn_source_hash(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels)
+{
+	//fnv-1a of every 1MB chunk on its own, then of the chunk hashes, the same for any worker count
+	const size_t chunk = size_t(1) << 20;
+	const uint64_t basis = 14695981039346656037ull, prime = 1099511628211ull;
+	size_t bytes = size_t(w) * h * channels;
+	size_t chunks = (bytes + chunk - 1) / chunk;
+	std::vector<uint64_t> sums(chunks);
+	parallel_blocks(0, chunks, worker_count(), [&](size_t c0, size_t c1, unsigned int) {
+		for (size_t c = c0; c < c1; c++)
+		{
+			uint64_t s = basis;
+			for (size_t i = c * chunk, e = std::min(bytes, i + chunk); i < e; i++) {
+				s = (s ^ pixels[i]) * prime;
+			}
+			sums[c] = s;
+		}
+	});
+	uint64_t hash = basis;
+	uint64_t dims[3] = { w, h, channels };
+	for (uint64_t v : dims) {
+		hash = (hash ^ v) * prime;
+	}
+	for (uint64_t s : sums) {
+		hash = (hash ^ s) * prime;
+	}
+	return hash;
+}
+
+void encode_bcn(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels, bool mips, bcn_image& out)
+{
+	out.format = channels == 4 ? BCN_BC3 : BCN_BC1;
+	out.levels.clear();
+	if (w == 0 || h == 0) {
+		return;
+	}
+	out.levels.emplace_back();
+	encode_bcn_level(pixels, w, h, channels, out.levels.back());
+	std::vector<unsigned char> level, next;
+	const unsigned char* src = pixels;
+	while (mips && (w > 1 || h > 1))
+	{
+		half_level(src, w, h, channels, next, w, h);
+		level.swap(next);
+		src = level.data();
+		out.levels.emplace_back();
+		encode_bcn_level(src, w, h, channels, out.levels.back());
+	}
+}
+
+void decode_bcn(const bcn_image& img, unsigned int level, std::vector<unsigned char>& rgba)
+{
+	const bcn_level& l = img.levels[level];
+	unsigned int bw = (l.wid + 3) / 4, bh = (l.hei + 3) / 4;
+	unsigned int block_bytes = img.block_bytes();
+	rgba.resize(size_t(l.wid) * l.hei * 4);
+	parallel_for(0, size_t(bw) * bh, [&](size_t b) {
+		const unsigned char* src = l.blocks.data() + b * block_bytes;
+		unsigned char alpha[8];
+		if (img.format == BCN_BC3)
+		{
+			unsigned int a0 = src[0], a1 = src[1];
+			alpha[0] = (unsigned char)a0;
+			alpha[1] = (unsigned char)a1;
+			for (unsigned int i = 2; i < 8; i++) {
+				if (a0 > a1) alpha[i] = (unsigned char)(((8 - i) * a0 + (i - 1) * a1) / 7);
+				else if (i < 6) alpha[i] = (unsigned char)(((6 - i) * a0 + (i - 1) * a1) / 5);
+				else alpha[i] = i == 6 ? 0 : 255;
+			}
+		}
+		const unsigned char* color = img.format == BCN_BC3 ? src + 8 : src;
+		int palette[4][3];
+		bc1_palette(color, img.format == BCN_BC3, palette);
+		uint32_t idx = get16(color + 4) | (uint32_t(get16(color + 6)) << 16);
+		uint64_t abits = 0;
+		for (int n = 0; n < 6 && img.format == BCN_BC3; n++) {
+			abits |= uint64_t(src[2 + n]) << (8 * n);
+		}
+		unsigned int bx = unsigned(b % bw), by = unsigned(b / bw);
+		for (unsigned int m = 0; m < MC_BLOCK_SAMPLES; m++)
+		{
+			unsigned int x = bx * 4 + m % 4, y = by * 4 + m / 4;
+			if (x >= l.wid || y >= l.hei) {
+				continue;
+			}
+			unsigned char* dst = rgba.data() + (size_t(y) * l.wid + x) * 4;
+			const int* c = palette[(idx >> (2 * m)) & 3];
+			dst[0] = (unsigned char)c[0];
+			dst[1] = (unsigned char)c[1];
+			dst[2] = (unsigned char)c[2];
+			dst[3] = img.format == BCN_BC3 ? alpha[(abits >> (3 * m)) & 7] : 255;
+		}
+	});
+}
+
+bool save_bcn(const bcn_image& img, uint64_t hash, const char* path)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cout << "failed to open " << path << std::endl;
+		return false;
+	}
+	bcn_file_header h;
+	std::memcpy(h.magic, bcn_magic, 4);
+	h.version = 1;
+	h.format = img.format;
+	h.levels = (unsigned int)img.levels.size();
+	h.hash = hash;
+	out.write((const char*)&h, sizeof(h));
+	for (const bcn_level& l : img.levels)
+	{
+		unsigned int dims[2] = { l.wid, l.hei };
+		out.write((const char*)dims, sizeof(dims));
+		out.write((const char*)l.blocks.data(), l.blocks.size());
+	}
+	return bool(out);
+}
+
+bool load_bcn(const char* path, uint64_t hash, bcn_image& out)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+	bcn_file_header h;
+	if (!in.read((char*)&h, sizeof(h)) || std::memcmp(h.magic, bcn_magic, 4) != 0 || h.version != 1 || h.format > BCN_BC3) {
+		std::cout << "unexpected file format: " << path << std::endl;
+		return false;
+	}
+	if (h.hash != hash) {
+		return false;
+	}
+	out.format = bcn_format(h.format);
+	out.levels.resize(h.levels);
+	for (bcn_level& l : out.levels)
+	{
+		unsigned int dims[2];
+		if (!in.read((char*)dims, sizeof(dims)) || dims[0] == 0 || dims[1] == 0 || dims[0] > 65536 || dims[1] > 65536) {
+			std::cout << "truncated bcn file: " << path << std::endl;
+			return false;
+		}
+		l.wid = dims[0];
+		l.hei = dims[1];
+		l.blocks.resize(level_bytes(l.wid, l.hei, out.block_bytes()));
+		if (!in.read((char*)l.blocks.data(), l.blocks.size())) {
+			std::cout << "truncated bcn file: " << path << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void load_or_encode_bcn(const unsigned char* pixels, unsigned int w, unsigned int h, unsigned int channels, bool mips,
+	const char* cache_path, bcn_image& out)
+{
+	uint64_t hash = bcn_source_hash(pixels, w, h, channels);
+	if (load_bcn(cache_path, hash, out) && out.levels.size() == (mips ? mip_count(w, h) : 1)) {
+		return;
+	}
+	encode_bcn(pixels, w, h, channels, mips, out);
+	save_bcn(out, hash, cache_path);
+}
+
+bool bcn_supported()
+{
+	return GLEW_EXT_texture_compression_s3tc != 0;
+}
+
+void upload_bcn_texture(const bcn_image& img, GLuint id)
+{
+	GLenum format = img.format == BCN_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	GLCall(glBindTexture(GL_TEXTURE_2D, id));
+	for (size_t i = 0; i < img.levels.size(); i++)
+	{
+		const bcn_level& l = img.levels[i];
+		GLCall(glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), format, l.wid, l.hei, 0, GLsizei(l.blocks.size()), l.blocks.data()));
+	}
+	GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(img.levels.size()) - 1));
+}
@@ -1,5 +1,6 @@
 #include "../headers/mesh_loader.h"
 #include "../headers/gl_macro.h"
+#include "../headers/mc_bcn.h"
 #include <SOIL/SOIL.h>
 
 
@@ -56,15 +57,9 @@ void mesh_loader::processNode(aiNode * node, const aiScene * scene)
 #endif
 }
 
-Model mesh_loader::processModel(aiMesh * mesh, const aiScene * scene)
+//vertices and triangle indices of an assimp mesh, shared by the models and the headless tools
+static void mesh_geometry(aiMesh * mesh, std::vector<vertex>& vertices, std::vector<unsigned int>& indices)
 {
-#ifdef SHOW_MSG
-	std::cout << "inside process model" << std::endl;
-#endif
-	std::vector<vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
-
 	for (int i = 0; i < mesh->mNumVertices; i++)
 	{
 		vertex vert;
@@ -111,7 +106,50 @@ Model mesh_loader::processModel(aiMesh * mesh, const aiScene * scene)
 		for (int j = 0; j < face.mNumIndices; j++)
 			indices.push_back(face.mIndices[j]);
 	}
+}
 
+//first mesh met by processNode, no gl objects are made so it works without a context
+bool load_mesh_geometry(const char * path, std::vector<vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	Assimp::Importer importer;
+	const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_OptimizeGraph | aiProcess_OptimizeMeshes);
+	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+	{
+		std::cout << "[ERROR:ASSIMP]: " << importer.GetErrorString() << std::endl;
+		return false;
+	}
+	std::vector<aiNode*> pending(1, scene->mRootNode);
+	while (!pending.empty())
+	{
+		aiNode *node = pending.back();
+		pending.pop_back();
+		if (node->mNumMeshes > 0)
+		{
+			vertices.clear();
+			indices.clear();
+			mesh_geometry(scene->mMeshes[node->mMeshes[0]], vertices, indices);
+			return true;
+		}
+		//children in the order processNode visits them
+		for (int i = int(node->mNumChildren) - 1; i >= 0; i--)
+		{
+			pending.push_back(node->mChildren[i]);
+		}
+	}
+	std::cout << "no mesh in " << path << std::endl;
+	return false;
+}
+
+Model mesh_loader::processModel(aiMesh * mesh, const aiScene * scene)
+{
+#ifdef SHOW_MSG
+	std::cout << "inside process model" << std::endl;
+#endif
+	std::vector<vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<Texture> textures;
+
+	mesh_geometry(mesh, vertices, indices);
 
 	aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 	
@@ -253,8 +291,18 @@ unsigned int TextureFromFile(const char * path, const std::string& directory, bo
 		}
 
 		GLCall(glBindTexture(GL_TEXTURE_2D, textureID););
-		GLCall(glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data));
-		GLCall(glGenerateMipmap(GL_TEXTURE_2D));
+		if ((nrComponents == 3 || nrComponents == 4) && bcn_supported())
+		{
+			//bc1 / bc3 with mips, encoded once and kept next to the image
+			bcn_image bcn;
+			load_or_encode_bcn(data, width, height, nrComponents, true, (filename + ".bcn").c_str(), bcn);
+			upload_bcn_texture(bcn, textureID);
+		}
+		else
+		{
+			GLCall(glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data));
+			GLCall(glGenerateMipmap(GL_TEXTURE_2D));
+		}
 
 		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
 		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));